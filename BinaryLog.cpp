@@ -0,0 +1,502 @@
+#include "BinaryLog.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef OBEY_ZLIB
+#include <zlib.h>
+#endif
+
+static const size_t VIN_LENGTH = 17;
+
+static uint64_t channel_key(int ecu, int service, int pid)
+{
+    return static_cast<uint64_t>(ecu + 1) << 32 | static_cast<uint64_t>(service & 0xff) << 16 | (pid & 0xffff);
+}
+
+static std::system_error corrupt(const char *what)
+{
+    return std::system_error(std::make_error_code(std::errc::illegal_byte_sequence), what);
+}
+
+LogWriter::LogWriter(const std::string &path, const log_header &header)
+: file{ ::fopen(path.c_str(), "wb") }, origin{ std::chrono::steady_clock::now() }
+{
+    if (file == nullptr)
+    {
+        throw std::system_error(errno, std::system_category(), "Log open");
+    }
+
+    const int64_t start = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    char vin[VIN_LENGTH] = {};
+    std::memcpy(vin, header.vin.data(), std::min(header.vin.size(), VIN_LENGTH));
+
+    const uint16_t reserved = 0;
+    const uint16_t ecus = static_cast<uint16_t>(header.capabilities.size());
+
+    try
+    {
+        write(LOG_MAGIC, sizeof(LOG_MAGIC));
+        write(&LOG_VERSION, sizeof(LOG_VERSION));
+        write(&reserved, sizeof(reserved));
+        write(&start, sizeof(start));
+        write(vin, sizeof(vin));
+        write(&ecus, sizeof(ecus));
+        for (const auto &[ecu, pages] : header.capabilities)
+        {
+            const int16_t number = static_cast<int16_t>(ecu);
+            write(&number, sizeof(number));
+            write(pages.data(), sizeof(pages));
+        }
+
+        block.reserve(BLOCK_SIZE + 64);
+    }
+    catch (...)
+    {
+        // no destructor for a constructor that throws
+        ::fclose(file);
+        throw;
+    }
+}
+
+LogWriter::~LogWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (const std::system_error &)
+    {
+        // nothing left to report to
+    }
+}
+
+uint32_t LogWriter::channel(int ecu, int service, int pid)
+{
+    const auto [found, added] = lookup.try_emplace(channel_key(ecu, service, pid), channels.size());
+    if (added)
+    {
+        channels.push_back({ecu, service, pid});
+        if (!block.empty())
+        {
+            // later blocks repeat it with the whole dictionary
+            define(found->second);
+        }
+    }
+
+    return found->second;
+}
+
+void LogWriter::sample(uint32_t channel, std::chrono::steady_clock::time_point when, double value)
+{
+    begin(log_record_type::sample_record, when);
+    varint(channel);
+
+    // host byte order, little endian on every supported target
+    uint8_t bytes[sizeof(value)];
+    std::memcpy(bytes, &value, sizeof(value));
+    block.insert(block.end(), bytes, bytes + sizeof(bytes));
+
+    if (block.size() >= BLOCK_SIZE)
+    {
+        flush();
+    }
+}
+
+void LogWriter::frame(const can_rx_frame &frame)
+{
+    begin(log_record_type::frame_record, frame.received);
+    varint(frame.id);
+    block.push_back(frame.length);
+    block.insert(block.end(), frame.data.begin(), frame.data.begin() + frame.length);
+
+    if (block.size() >= BLOCK_SIZE)
+    {
+        flush();
+    }
+}
+
+void LogWriter::close()
+{
+    if (file == nullptr)
+    {
+        return;
+    }
+
+    flush();
+
+    const uint64_t trailer = offset;
+
+    const uint32_t count = static_cast<uint32_t>(channels.size());
+    write(&count, sizeof(count));
+    for (const log_channel &each : channels)
+    {
+        const int32_t ecu = each.ecu;
+        const uint16_t service = static_cast<uint16_t>(each.service);
+        const uint16_t pid = static_cast<uint16_t>(each.pid);
+        write(&ecu, sizeof(ecu));
+        write(&service, sizeof(service));
+        write(&pid, sizeof(pid));
+    }
+
+    const uint32_t blocks = static_cast<uint32_t>(index.size());
+    write(&blocks, sizeof(blocks));
+    write(index.data(), index.size() * sizeof(log_block));
+
+    write(&trailer, sizeof(trailer));
+    write(LOG_INDEX_MAGIC, sizeof(LOG_INDEX_MAGIC));
+
+    const bool failed = (::fclose(file) != 0);
+    file = nullptr;
+    if (failed)
+    {
+        throw std::system_error(errno, std::system_category(), "Log close");
+    }
+}
+
+void LogWriter::begin(log_record_type type, std::chrono::steady_clock::time_point when)
+{
+    const int64_t elapsed = std::chrono::duration_cast<std::chrono::microseconds>(when - origin).count();
+
+    // time never goes backwards within the log, deltas stay unsigned
+    const uint64_t time = std::max(static_cast<uint64_t>(std::max<int64_t>(elapsed, 0)), previous);
+
+    if (block.empty())
+    {
+        current = {offset, time, time, 0, 0};
+        previous = time;
+        for (uint32_t each = 0; each < channels.size(); each++)
+        {
+            define(each);
+        }
+    }
+
+    block.push_back(type);
+    varint(time - previous);
+    previous = time;
+
+    current.last = time;
+    current.records++;
+}
+
+void LogWriter::define(uint32_t channel)
+{
+    const log_channel &each = channels[channel];
+
+    block.push_back(log_record_type::channel_definition);
+    varint(0);
+    varint(channel);
+    varint(each.ecu + 1);
+    varint(each.service);
+    varint(each.pid);
+}
+
+void LogWriter::varint(uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        block.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    block.push_back(static_cast<uint8_t>(value));
+}
+
+void LogWriter::flush()
+{
+    if (block.empty())
+    {
+        return;
+    }
+
+    log_block_header header{static_cast<uint32_t>(block.size()), static_cast<uint32_t>(block.size()),
+        current.first, current.last, current.records, log_compression::uncompressed, {LOG_BLOCK_SYNC[0], LOG_BLOCK_SYNC[1], LOG_BLOCK_SYNC[2]}};
+    const uint8_t *data = block.data();
+
+#ifdef OBEY_ZLIB
+    uLongf length = ::compressBound(block.size());
+    stored.resize(length);
+    if (::compress2(stored.data(), &length, block.data(), block.size(), Z_BEST_SPEED) == Z_OK && length < block.size())
+    {
+        header.stored_size = static_cast<uint32_t>(length);
+        header.compression = log_compression::zlib_compressed;
+        data = stored.data();
+    }
+#endif
+
+    index.push_back(current);
+
+    write(&header, sizeof(header));
+    write(data, header.stored_size);
+
+    block.clear();
+}
+
+void LogWriter::write(const void *data, size_t size)
+{
+    if (size > 0 && ::fwrite(data, size, 1, file) != 1)
+    {
+        throw std::system_error(errno, std::system_category(), "Log write");
+    }
+    offset += size;
+}
+
+LogReader::LogReader(const std::string &path)
+: fd{ ::open(path.c_str(), O_RDONLY | O_CLOEXEC) }
+{
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "Log open");
+    }
+
+    struct stat status{};
+    if (::fstat(fd, &status) < 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::system_category(), "Log stat");
+    }
+    size = status.st_size;
+
+    uint64_t cursor = 0;
+    auto read = [&](void *data, size_t length) {
+        if (::pread(fd, data, length, cursor) != static_cast<ssize_t>(length))
+        {
+            ::close(fd);
+            throw corrupt("Truncated log");
+        }
+        cursor += length;
+    };
+
+    char magic[sizeof(LOG_MAGIC)];
+    uint16_t version = 0;
+    uint16_t reserved = 0;
+    char vin[VIN_LENGTH];
+    uint16_t ecus = 0;
+
+    read(magic, sizeof(magic));
+    read(&version, sizeof(version));
+    if (std::memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0 || version != LOG_VERSION)
+    {
+        ::close(fd);
+        throw corrupt("Not an obey log");
+    }
+
+    read(&reserved, sizeof(reserved));
+    read(&file_header.start, sizeof(file_header.start));
+    read(vin, sizeof(vin));
+    file_header.vin.assign(vin, strnlen(vin, sizeof(vin)));
+
+    read(&ecus, sizeof(ecus));
+    for (uint16_t i = 0; i < ecus; i++)
+    {
+        int16_t ecu = 0;
+        std::array<uint32_t, LOG_PAGES> pages{};
+        read(&ecu, sizeof(ecu));
+        read(pages.data(), sizeof(pages));
+        file_header.capabilities[ecu] = pages;
+    }
+
+    const uint64_t blocks_start = cursor;
+
+    // closed log: trailer with the dictionary and the block index
+    char index_magic[sizeof(LOG_INDEX_MAGIC)] = {};
+    uint64_t trailer = 0;
+    if (size >= blocks_start + sizeof(trailer) + sizeof(index_magic))
+    {
+        cursor = size - sizeof(trailer) - sizeof(index_magic);
+        read(&trailer, sizeof(trailer));
+        read(index_magic, sizeof(index_magic));
+    }
+
+    if (std::memcmp(index_magic, LOG_INDEX_MAGIC, sizeof(index_magic)) != 0 || trailer < blocks_start || trailer >= size)
+    {
+        scan(blocks_start);
+        return;
+    }
+
+    cursor = trailer;
+
+    uint32_t count = 0;
+    read(&count, sizeof(count));
+    dictionary.resize(count);
+    for (log_channel &each : dictionary)
+    {
+        int32_t ecu = 0;
+        uint16_t service = 0;
+        uint16_t pid = 0;
+        read(&ecu, sizeof(ecu));
+        read(&service, sizeof(service));
+        read(&pid, sizeof(pid));
+        each = {ecu, service, pid};
+    }
+
+    read(&count, sizeof(count));
+    index.resize(count);
+    read(index.data(), count * sizeof(log_block));
+}
+
+LogReader::~LogReader()
+{
+    ::close(fd);
+}
+
+void LogReader::scan(uint64_t offset)
+{
+    // block headers only, the dictionary fills in from the blocks as they are read
+    const uint64_t end = size;
+
+    log_block_header header{};
+    while (offset + sizeof(header) <= end &&
+        ::pread(fd, &header, sizeof(header), offset) == sizeof(header) &&
+        offset + sizeof(header) + header.stored_size <= end &&
+        std::memcmp(header.sync, LOG_BLOCK_SYNC, sizeof(header.sync)) == 0 &&
+        header.first <= header.last && (index.empty() || header.first >= index.back().last))
+    {
+        index.push_back({offset, header.first, header.last, header.records, 0});
+        offset += sizeof(header) + header.stored_size;
+    }
+}
+
+void LogReader::seek(uint64_t time)
+{
+    const auto found = std::lower_bound(index.cbegin(), index.cend(), time, [](const log_block &block, uint64_t time) {
+        return block.last < time;
+    });
+
+    next_block = found - index.cbegin();
+    raw.clear();
+    position = 0;
+    skip_until = time;
+}
+
+bool LogReader::next(log_record &record)
+{
+    while (true)
+    {
+        if (position >= raw.size())
+        {
+            if (next_block >= index.size() || !load(next_block++))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        record.type = static_cast<log_record_type>(raw[position++]);
+        time += varint();
+        record.time = time;
+
+        switch (record.type)
+        {
+        case log_record_type::channel_definition:
+        {
+            const uint32_t channel = static_cast<uint32_t>(varint());
+            const int ecu = static_cast<int>(varint()) - 1;
+            const int service = static_cast<int>(varint());
+            const int pid = static_cast<int>(varint());
+            if (channel >= dictionary.size())
+            {
+                dictionary.resize(channel + 1, {-1, -1, -1});
+            }
+            dictionary[channel] = {ecu, service, pid};
+            continue;
+        }
+        case log_record_type::sample_record:
+            record.channel = static_cast<uint32_t>(varint());
+            if (position + sizeof(record.value) > raw.size())
+            {
+                throw corrupt("Corrupt log block");
+            }
+            std::memcpy(&record.value, &raw[position], sizeof(record.value));
+            position += sizeof(record.value);
+            break;
+        case log_record_type::frame_record:
+            record.id = static_cast<uint32_t>(varint());
+            if (position >= raw.size() || raw[position] > record.data.size() || position + 1 + raw[position] > raw.size())
+            {
+                throw corrupt("Corrupt log block");
+            }
+            record.length = raw[position++];
+            std::memcpy(record.data.data(), &raw[position], record.length);
+            position += record.length;
+            break;
+        default:
+            throw corrupt("Corrupt log block");
+        }
+
+        if (record.time >= skip_until)
+        {
+            return true;
+        }
+    }
+}
+
+bool LogReader::load(size_t block)
+{
+    log_block_header header{};
+    if (::pread(fd, &header, sizeof(header), index[block].offset) != sizeof(header))
+    {
+        return false;
+    }
+
+    stored.resize(header.stored_size);
+    if (::pread(fd, stored.data(), stored.size(), index[block].offset + sizeof(header)) != static_cast<ssize_t>(stored.size()))
+    {
+        return false;
+    }
+
+    if (header.compression == log_compression::uncompressed)
+    {
+        raw.swap(stored);
+    }
+    else if (header.compression == log_compression::zlib_compressed)
+    {
+#ifdef OBEY_ZLIB
+        raw.resize(header.raw_size);
+        uLongf length = raw.size();
+        if (::uncompress(raw.data(), &length, stored.data(), stored.size()) != Z_OK || length != raw.size())
+        {
+            throw corrupt("Corrupt log block");
+        }
+#else
+        throw std::system_error(std::make_error_code(std::errc::not_supported), "Compressed log, built without zlib");
+#endif
+    }
+    else
+    {
+        throw corrupt("Corrupt log block");
+    }
+
+    position = 0;
+    time = header.first;
+
+    return true;
+}
+
+uint64_t LogReader::varint()
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (position >= raw.size())
+        {
+            throw corrupt("Corrupt log block");
+        }
+
+        const uint8_t byte = raw[position++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+
+    throw corrupt("Corrupt log block");
+}
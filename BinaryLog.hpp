@@ -0,0 +1,160 @@
+#ifndef __BINARY_LOG_H
+#define __BINARY_LOG_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CAN.hpp"
+
+// Binary log of decoded samples and raw frames for long sessions
+//
+//  header:  magic, version, start time, VIN, supported show data PIDs per ECU
+//  blocks:  block header + records, compressed with zlib when built with it.
+//           Each block starts with the whole channel dictionary so it decodes on its own.
+//  trailer: channel dictionary, block index, trailer offset + index magic
+//
+// Records are a type byte, the varint time delta to the previous record of the block
+// (microseconds), then
+//  channel: varint channel, ecu, service, pid
+//  sample:  varint channel, little endian double
+//  frame:   varint CAN id, length, data
+
+static const char LOG_MAGIC[8] = {'O', 'B', 'E', 'Y', 'L', 'O', 'G', '1'};
+static const char LOG_INDEX_MAGIC[8] = {'O', 'B', 'E', 'Y', 'I', 'D', 'X', '1'};
+static const char LOG_BLOCK_SYNC[3] = {'B', 'L', 'K'}; // finds the blocks of a log that was not closed
+static const uint16_t LOG_VERSION = 1;
+
+enum log_record_type:uint8_t {channel_definition, sample_record, frame_record};
+enum log_compression:uint8_t {uncompressed, zlib_compressed};
+
+static const int LOG_PAGES = 7; // supported show data PIDs 0x01-0xe0
+
+struct log_header
+{
+    int64_t start{}; // unix time, microseconds
+    std::string vin{};
+    std::map<int, std::array<uint32_t, LOG_PAGES>> capabilities{}; // by ECU
+};
+
+// (ECU, service, PID) of a sample, ECU -1 when unknown
+struct log_channel
+{
+    int ecu;
+    int service;
+    int pid;
+};
+
+struct log_record
+{
+    log_record_type type;
+    uint64_t time; // microseconds since the start
+    uint32_t channel; // sample
+    double value; // sample
+    uint32_t id; // frame
+    uint8_t length; // frame
+    std::array<uint8_t, 8> data; // frame
+};
+
+struct log_block
+{
+    uint64_t offset; // of the block header in the file
+    uint64_t first; // time of the first record
+    uint64_t last; // time of the last record
+    uint32_t records;
+    uint32_t reserved;
+};
+static_assert(sizeof(log_block) == 32);
+
+struct log_block_header
+{
+    uint32_t raw_size;
+    uint32_t stored_size;
+    uint64_t first;
+    uint64_t last;
+    uint32_t records;
+    uint8_t compression; // log_compression
+    char sync[3]; // LOG_BLOCK_SYNC
+};
+static_assert(sizeof(log_block_header) == 32);
+
+class LogWriter
+{
+    public:
+        // the start time of the header is set to now
+        LogWriter(const std::string &path, const log_header &header);
+        ~LogWriter();
+
+        // dictionary id of a channel, defined on first use
+        uint32_t channel(int ecu, int service, int pid);
+
+        void sample(uint32_t channel, std::chrono::steady_clock::time_point when, double value);
+        void frame(const can_rx_frame &frame);
+
+        // writes the last block and the trailer
+        void close();
+
+    private:
+        static const size_t BLOCK_SIZE = 64 * 1024; // uncompressed
+
+        void begin(log_record_type type, std::chrono::steady_clock::time_point when);
+        void define(uint32_t channel);
+        void varint(uint64_t value);
+        void flush();
+        void write(const void *data, size_t size);
+
+        FILE *file;
+        const std::chrono::steady_clock::time_point origin;
+        uint64_t offset{};
+
+        std::vector<log_channel> channels;
+        std::unordered_map<uint64_t, uint32_t> lookup;
+        std::vector<log_block> index;
+
+        std::vector<uint8_t> block;
+        std::vector<uint8_t> stored;
+        log_block current{};
+        uint64_t previous{}; // time of the previous record
+};
+
+class LogReader
+{
+    public:
+        LogReader(const std::string &path);
+        ~LogReader();
+
+        const log_header &header() const { return file_header; }
+        const std::vector<log_channel> &channels() const { return dictionary; }
+        const std::vector<log_block> &blocks() const { return index; }
+
+        // next record at or after time; the following next() calls continue from there
+        void seek(uint64_t time);
+
+        // samples and frames in time order, false at the end
+        bool next(log_record &record);
+
+    private:
+        bool load(size_t block);
+        uint64_t varint();
+        void scan(uint64_t offset); // rebuilds the index of a log that was not closed
+
+        int fd;
+        uint64_t size{};
+        log_header file_header;
+        std::vector<log_channel> dictionary;
+        std::vector<log_block> index;
+
+        std::vector<uint8_t> raw;
+        std::vector<uint8_t> stored;
+        size_t position{};
+        size_t next_block{};
+        uint64_t time{};
+        uint64_t skip_until{};
+};
+
+#endif // __BINARY_LOG_H
@@ -0,0 +1,125 @@
+#include "BusLoad.hpp"
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+// SOF, arbitration, control, CRC, ACK, EOF and interframe space
+static const uint32_t STANDARD_OVERHEAD = 47;
+static const uint32_t EXTENDED_OVERHEAD = 67;
+static const double STUFFING = 1.1; // typical, worst case is about 1.2
+
+// keeps polling alive, slowly, on a bus already over the target
+static const double MIN_SHARE = 0.005;
+
+BusPacer::BusPacer(const std::string &interface, uint32_t bitrate, double target)
+: path{ "/sys/class/net/" + interface + "/statistics/" }, bitrate{ static_cast<double>(bitrate) },
+    target{ bitrate * std::clamp(target, 0.0, 100.0) / 100 }
+{
+    rate = std::max(this->target, this->bitrate * MIN_SHARE);
+
+    // bursts of 10 ms, at least one frame
+    capacity = std::max(rate / 100, static_cast<double>(frame_bits(true, 8)));
+    tokens = capacity;
+
+    filled = sampled = std::chrono::steady_clock::now();
+    statistics = read_statistics(packets, bytes);
+}
+
+uint32_t BusPacer::frame_bits(bool extended, size_t length)
+{
+    return static_cast<uint32_t>(((extended ? EXTENDED_OVERHEAD : STANDARD_OVERHEAD) + 8 * length) * STUFFING);
+}
+
+void BusPacer::acquire(bool extended, size_t length)
+{
+    const double bits = frame_bits(extended, length);
+
+    auto now = std::chrono::steady_clock::now();
+    if (now - sampled >= REFRESH)
+    {
+        refresh(now);
+    }
+    refill(now);
+
+    if (tokens < bits)
+    {
+        const auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::duration<double>((bits - tokens) / rate));
+
+        std::this_thread::sleep_for(wait);
+
+        throttle_count++;
+        throttle_time += wait;
+        Metrics::throttle(wait);
+
+        now = std::chrono::steady_clock::now();
+        refill(now);
+    }
+
+    tokens -= bits;
+    own_bits += bits;
+}
+
+void BusPacer::refill(std::chrono::steady_clock::time_point now)
+{
+    const double elapsed = std::chrono::duration<double>(now - filled).count();
+    tokens = std::min(capacity, tokens + rate * elapsed);
+    filled = now;
+}
+
+void BusPacer::refresh(std::chrono::steady_clock::time_point now)
+{
+    const double interval = std::chrono::duration<double>(now - sampled).count();
+    sampled = now;
+
+    uint64_t latest_packets = 0;
+    uint64_t latest_bytes = 0;
+    double bus_bits = own_bits;
+    if (statistics && read_statistics(latest_packets, latest_bytes))
+    {
+        // frame format unknown, counted as 11-bit
+        bus_bits = ((latest_packets - packets) * STANDARD_OVERHEAD + (latest_bytes - bytes) * 8) * STUFFING;
+        packets = latest_packets;
+        bytes = latest_bytes;
+    }
+
+    // everybody else, our frames are in the interface statistics too
+    const double others = std::max(bus_bits - own_bits, 0.0) / interval;
+    own_bits = 0;
+
+    rate = std::max(target - others, bitrate * MIN_SHARE);
+    capacity = std::max(rate / 100, static_cast<double>(frame_bits(true, 8)));
+
+    bus_load = 100 * bus_bits / interval / bitrate;
+    Metrics::bus_load(bus_load);
+}
+
+bool BusPacer::read_statistics(uint64_t &packets, uint64_t &bytes)
+{
+    auto read = [&](const char *name, uint64_t &total) -> bool {
+        uint64_t sum = 0;
+        for (const char *direction : {"rx_", "tx_"})
+        {
+            FILE *file = ::fopen((path + direction + name).c_str(), "r");
+            if (file == nullptr)
+            {
+                return false;
+            }
+
+            unsigned long long value = 0;
+            const bool parsed = (::fscanf(file, "%llu", &value) == 1);
+            ::fclose(file);
+            if (!parsed)
+            {
+                return false;
+            }
+            sum += value;
+        }
+        total = sum;
+        return true;
+    };
+
+    return read("packets", packets) && read("bytes", bytes);
+}
@@ -0,0 +1,57 @@
+#ifndef __BUS_LOAD_H
+#define __BUS_LOAD_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Paces requests with a token bucket so the bus load stays under a target
+// The load is estimated from the interface statistics, every frame on the bus
+// including ours, refreshed every REFRESH. Our own budget is what the target
+// leaves after the traffic of everybody else.
+class BusPacer
+{
+    public:
+        // bitrate in bit/s, target in percent of it
+        BusPacer(const std::string &interface, uint32_t bitrate, double target);
+
+        // waits until the frame fits in the budget, then charges it
+        void acquire(bool extended, size_t length = 8);
+
+        double load() const { return bus_load; } // percent, last interval
+        uint64_t throttled() const { return throttle_count; }
+        std::chrono::nanoseconds throttled_time() const { return throttle_time; }
+        bool observed() const { return statistics; } // false when the interface statistics are unavailable
+
+        // frame on the wire with an estimate of the stuff bits
+        static uint32_t frame_bits(bool extended, size_t length);
+
+    private:
+        static constexpr auto REFRESH = std::chrono::milliseconds(100);
+
+        void refresh(std::chrono::steady_clock::time_point now);
+        void refill(std::chrono::steady_clock::time_point now);
+        bool read_statistics(uint64_t &packets, uint64_t &bytes);
+
+        const std::string path; // /sys/class/net/<interface>/statistics/
+        const double bitrate;
+        const double target; // bit/s
+
+        double rate; // our bit/s
+        double tokens;
+        double capacity;
+        std::chrono::steady_clock::time_point filled;
+
+        bool statistics{};
+        std::chrono::steady_clock::time_point sampled;
+        uint64_t packets{};
+        uint64_t bytes{};
+        double own_bits{}; // charged since the last refresh
+
+        double bus_load{};
+        uint64_t throttle_count{};
+        std::chrono::nanoseconds throttle_time{};
+};
+
+#endif // __BUS_LOAD_H
@@ -1,4 +1,6 @@
 #include "CAN.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 
 #include <cerrno>
 #include <cstring>
@@ -6,6 +8,8 @@
 #include <unistd.h>
 #include <poll.h>
 
+#include <sys/eventfd.h>
+
 #include <net/if.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
@@ -36,10 +40,24 @@ CANDevice::CANDevice(std::string interface)
     {
         throw std::system_error(errno, std::system_category(), "Bind");
     }
+
+    // report the kernel drop counter with every received frame
+    const int enable = 1;
+    ::setsockopt(sockfd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable));
+}
+
+CANDevice::CANDevice(int socket)
+: sockfd{ socket }
+{
+    if (sockfd < 0)
+    {
+        throw std::system_error(std::make_error_code(std::errc::bad_file_descriptor), "Socket");
+    }
 }
 
 CANDevice::~CANDevice()
 {
+    stop_rx_thread();
     ::close(sockfd);
 }
 
@@ -50,12 +68,30 @@ void CANDevice::nofilter()
 
 void CANDevice::filter(uint32_t id, uint32_t mask)
 {
-    ::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, nullptr, 0);
+    // Always match on the frame format and drop remote frames, so a 11-bit filter never
+    // passes 29-bit frames (and vice versa). The new filter replaces the old one in a
+    // single call, leaving no window where all bus traffic is received.
+    const uint32_t id_mask = (id & CAN_EFF_FLAG) ? CAN_EFF_MASK : CAN_SFF_MASK;
 
-    can_filter filter[] = {{id, CAN_SFF_MASK & mask}};
+    can_filter filter[] = {{id & (CAN_EFF_FLAG | id_mask), (id_mask & mask) | CAN_EFF_FLAG | CAN_RTR_FLAG}};
     ::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter[0], sizeof(filter));
 }
 
+void CANDevice::filter(const std::vector<can_filter> &filters)
+{
+    ::setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, filters.data(), filters.size() * sizeof(can_filter));
+}
+
+void CANDevice::receive_buffer(int bytes)
+{
+    // the kernel doubles the requested size for its bookkeeping
+    if ( ::setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &bytes, sizeof(bytes)) < 0 &&
+        ::setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &bytes, sizeof(bytes)) < 0 )
+    {
+        throw std::system_error(errno, std::system_category(), "Receive buffer");
+    }
+}
+
 void CANDevice::raw_send(const uint8_t *data, size_t len)
 {
     if ( ::send(sockfd, data, len, 0 ) < 0 )
@@ -73,9 +109,40 @@ void CANDevice::data_send(uint32_t id, const std::array<uint8_t, CAN_MAX_DLEN> &
     std::copy( data.cbegin(), data.cend(), frame.data );
 
     raw_send( reinterpret_cast<const uint8_t*>( &frame ), sizeof(frame) );
+    Metrics::frame(frame_direction::tx);
+
+#ifdef OBEY_TRACE
+    uint64_t bytes = 0;
+    std::memcpy(&bytes, frame.data, sizeof(bytes));
+    OBEY_TRACE_EVENT(trace_type::can_tx, id, frame.len, 0, bytes);
+#endif
 }
 
 bool CANDevice::data_receive(uint32_t &id, std::array<uint8_t, CAN_MAX_DLEN> &data)
+{
+    can_rx_frame frame{};
+    if (!frame_receive(frame))
+    {
+        return false;
+    }
+
+    id = frame.id;
+    data = frame.data;
+
+    return true;
+}
+
+bool CANDevice::frame_receive(can_rx_frame &frame)
+{
+    if (rx_queue)
+    {
+        return queue_receive(frame);
+    }
+
+    return socket_receive(frame);
+}
+
+bool CANDevice::socket_receive(can_rx_frame &frame)
 {
     pollfd fds[1] = {{ sockfd, POLLIN }};
     int result = ::poll(fds, sizeof(fds) / sizeof(pollfd), timeout_ms);
@@ -90,17 +157,199 @@ bool CANDevice::data_receive(uint32_t &id, std::array<uint8_t, CAN_MAX_DLEN> &da
         return false;
     }
 
-    can_frame frame{};
-    if ( ::recv(sockfd, &frame, sizeof(frame), 0 ) < 0 )
+    can_frame raw{};
+    iovec iov{ &raw, sizeof(raw) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint32_t))];
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if ( ::recvmsg(sockfd, &msg, 0 ) < 0 )
     {
         throw std::system_error(errno, std::system_category(), "Receive");
     }
 
-    id = frame.can_id;
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL)
+        {
+            uint32_t dropped = 0;
+            ::memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+
+            // cumulative count since the socket was opened
+            if (dropped != kernel_drops.load(std::memory_order_relaxed))
+            {
+                kernel_drops.store(dropped, std::memory_order_relaxed);
+                overruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    Metrics::frame(frame_direction::rx);
+
+#ifdef OBEY_TRACE
+    uint64_t bytes = 0;
+    std::memcpy(&bytes, raw.data, sizeof(bytes));
+    OBEY_TRACE_EVENT(trace_type::can_rx, raw.can_id, raw.len, 0, bytes);
+#endif
+
+    frame.received = std::chrono::steady_clock::now();
+    frame.id = raw.can_id;
+    frame.length = static_cast<uint8_t>(std::min<int>(raw.len, CAN_MAX_DLEN));
 
-    std::fill( data.begin(), data.end(), 0x00 );
+    std::fill( frame.data.begin(), frame.data.end(), 0x00 );
 
-    std::copy( frame.data, frame.data + frame.len, data.data() );
+    std::copy( raw.data, raw.data + frame.length, frame.data.data() );
 
     return true;
 }
+
+void CANDevice::start_rx_thread(size_t queue_size)
+{
+    if (rx_queue)
+    {
+        return;
+    }
+
+    rx_event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rx_event < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "Eventfd");
+    }
+
+    rx_queue = std::make_unique<SPSCQueue<can_rx_frame>>(queue_size);
+    stats = CANRxStats{};
+    rx_queue_full = 0;
+    rx_high_water = 0;
+
+    rx_running = true;
+    rx_thread = std::thread(&CANDevice::rx_loop, this);
+}
+
+void CANDevice::stop_rx_thread()
+{
+    if (!rx_queue)
+    {
+        return;
+    }
+
+    rx_running = false;
+    rx_thread.join();
+
+    rx_queue.reset();
+    ::close(rx_event);
+    rx_event = -1;
+}
+
+void CANDevice::rx_loop()
+{
+    try
+    {
+        while (rx_running.load(std::memory_order_relaxed))
+        {
+            can_rx_frame frame{};
+            if (!socket_receive(frame))
+            {
+                continue;
+            }
+
+            while (!rx_queue->push(frame))
+            {
+                // consumer behind, leave the rest in the socket buffer
+                rx_queue_full.fetch_add(1, std::memory_order_relaxed);
+                if (!rx_running.load(std::memory_order_relaxed))
+                {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+
+            const size_t depth = rx_queue->size();
+            if (depth > rx_high_water.load(std::memory_order_relaxed))
+            {
+                rx_high_water.store(depth, std::memory_order_relaxed);
+            }
+
+            // wake the consumer only when it is blocked
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (rx_sleeping.load(std::memory_order_relaxed))
+            {
+                const uint64_t one = 1;
+                (void)!::write(rx_event, &one, sizeof(one));
+            }
+        }
+    }
+    catch (...)
+    {
+        rx_error = std::current_exception();
+        rx_running = false;
+
+        const uint64_t one = 1;
+        (void)!::write(rx_event, &one, sizeof(one));
+    }
+}
+
+bool CANDevice::queue_receive(can_rx_frame &frame)
+{
+    bool received = rx_queue->pop(frame);
+
+    if (!received)
+    {
+        rx_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        received = rx_queue->pop(frame);
+        if (!received && rx_running.load())
+        {
+            pollfd fds[1] = {{ rx_event, POLLIN }};
+            if ( ::poll(fds, sizeof(fds) / sizeof(pollfd), timeout_ms) < 0 && errno != EINTR )
+            {
+                throw std::system_error(errno, std::system_category(), "Poll");
+            }
+
+            uint64_t count = 0;
+            (void)!::read(rx_event, &count, sizeof(count));
+
+            received = rx_queue->pop(frame);
+        }
+
+        rx_sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    if (!received)
+    {
+        if (!rx_running.load() && rx_error)
+        {
+            std::rethrow_exception(rx_error);
+        }
+
+        return false;
+    }
+
+    const auto handoff = std::chrono::steady_clock::now() - frame.received;
+    stats.frames++;
+    stats.handoff_total += handoff;
+    stats.handoff_max = std::max<std::chrono::nanoseconds>(stats.handoff_max, handoff);
+
+    return true;
+}
+
+const CANRxStats CANDevice::rx_stats() const
+{
+    CANRxStats result = stats;
+
+    result.kernel_drops = kernel_drops.load(std::memory_order_relaxed);
+    result.overruns = overruns.load(std::memory_order_relaxed);
+
+    socklen_t size = sizeof(result.receive_buffer);
+    ::getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &result.receive_buffer, &size);
+
+    result.queue_full = rx_queue_full.load(std::memory_order_relaxed);
+    result.queue_high_water = rx_high_water.load(std::memory_order_relaxed);
+    result.queue_capacity = rx_queue ? rx_queue->capacity() : 0;
+
+    return result;
+}
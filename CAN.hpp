@@ -4,26 +4,85 @@
 #include <string>
 #include <cstdint>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <linux/can.h>
 
+#include "SPSCQueue.hpp"
+
+struct can_rx_frame
+{
+    uint32_t id;
+    uint8_t length; // DLC as received, data is zero filled after it
+    std::array<uint8_t, CAN_MAX_DLEN> data;
+    std::chrono::steady_clock::time_point received;
+};
+
+// Receive path losses and hand-off between the RX thread and the consumer
+struct CANRxStats
+{
+    uint32_t kernel_drops{}; // frames dropped by the kernel, socket buffer full (SO_RXQ_OVFL)
+    uint64_t overruns{}; // receives that found the drop counter increased
+    int receive_buffer{}; // SO_RCVBUF as granted by the kernel
+
+    uint64_t frames{}; // frames handed to the consumer
+    uint64_t queue_full{}; // times the RX thread waited on a full queue
+    size_t queue_high_water{};
+    size_t queue_capacity{};
+    std::chrono::nanoseconds handoff_total{};
+    std::chrono::nanoseconds handoff_max{};
+};
+
 class CANDevice
 {
     public:
         CANDevice(std::string interface);
+        // an open socket of struct can_frame datagrams, e.g. one end of a socketpair; closed on destruction
+        explicit CANDevice(int socket);
         ~CANDevice();
 
         void data_send(uint32_t id, const std::array<uint8_t, CAN_MAX_DLEN> &data);
         bool data_receive(uint32_t &id, std::array<uint8_t, CAN_MAX_DLEN> &data);
+        bool frame_receive(can_rx_frame &frame);
 
-        void filter(uint32_t id, uint32_t mask = 0x7FF);
+        // id carries CAN_EFF_FLAG for 29-bit filters
+        void filter(uint32_t id, uint32_t mask = CAN_EFF_MASK);
+        void filter(const std::vector<can_filter> &filters);
         void nofilter();
 
+        // SO_RCVBUFFORCE when permitted (CAP_NET_ADMIN), otherwise SO_RCVBUF capped by rmem_max
+        void receive_buffer(int bytes);
+
+        // Drain the socket from a dedicated thread into a queue read by the receive calls
+        void start_rx_thread(size_t queue_size = 4096);
+        void stop_rx_thread();
+        const CANRxStats rx_stats() const;
+
     private:
         int sockfd;
 
         void raw_send(const uint8_t *data, size_t len);
+        bool socket_receive(can_rx_frame &frame);
+        bool queue_receive(can_rx_frame &frame);
+        void rx_loop();
 
         const int timeout_ms = 200;
+
+        std::unique_ptr<SPSCQueue<can_rx_frame>> rx_queue;
+        std::thread rx_thread;
+        std::atomic<bool> rx_running{};
+        std::atomic<bool> rx_sleeping{}; // consumer waits on rx_event
+        std::atomic<uint64_t> rx_queue_full{};
+        std::atomic<size_t> rx_high_water{};
+        std::atomic<uint32_t> kernel_drops{};
+        std::atomic<uint64_t> overruns{};
+        std::exception_ptr rx_error;
+        int rx_event{-1};
+        CANRxStats stats{};
 };
 
 #endif // __CAN_DEVICE_H
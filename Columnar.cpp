@@ -0,0 +1,255 @@
+#include "Columnar.hpp"
+#include "OBDDescriptor.hpp"
+#include "PID.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <system_error>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static size_t aligned(size_t offset)
+{
+    return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+}
+
+// base + increment * i, contiguous and branch free so the compiler vectorises it
+static void fill_affine(double *out, size_t count, double base, double increment)
+{
+    // int32 counters convert to double in vector registers
+    for (size_t done = 0; done < count; )
+    {
+        const int32_t chunk = static_cast<int32_t>(std::min<size_t>(count - done, INT32_MAX));
+        double *__restrict rows = out + done;
+        const double first = base + increment * static_cast<double>(done);
+
+        for (int32_t i = 0; i < chunk; i++)
+        {
+            rows[i] = first + increment * i;
+        }
+        done += chunk;
+    }
+}
+
+ColumnarExport::ColumnarExport(const log_header &header, const std::vector<log_channel> &channels)
+: start{ header.start }, channels{ channels }, samples(channels.size())
+{
+}
+
+void ColumnarExport::sample(uint32_t channel, uint64_t time, double value)
+{
+    if (channel >= samples.size())
+    {
+        // defined while reading a log that was not closed
+        samples.resize(channel + 1);
+        channels.resize(channel + 1, {-1, -1, -1});
+    }
+
+    samples[channel].time.push_back(static_cast<int64_t>(time));
+    samples[channel].value.push_back(value);
+}
+
+void ColumnarExport::define(const std::vector<log_channel> &dictionary)
+{
+    if (dictionary.size() > channels.size())
+    {
+        channels.resize(dictionary.size(), {-1, -1, -1});
+        samples.resize(dictionary.size());
+    }
+    std::copy(dictionary.cbegin(), dictionary.cend(), channels.begin());
+}
+
+void ColumnarExport::resample(const int64_t *time, const double *value, size_t count,
+    int64_t step, size_t rows, resample_mode mode, double *out)
+{
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+
+    // first row at or after a time
+    const auto row_at = [&](int64_t at) -> size_t {
+        if (at <= 0)
+        {
+            return 0;
+        }
+        return std::min<uint64_t>((static_cast<uint64_t>(at) + step - 1) / step, rows);
+    };
+
+    size_t row = (count > 0) ? row_at(time[0]) : rows;
+    std::fill(out, out + row, nan);
+
+    // each segment between two samples is an affine fill of the rows it covers
+    for (size_t i = 0; i + 1 < count && row < rows; i++)
+    {
+        const size_t end = row_at(time[i + 1]);
+        if (end <= row)
+        {
+            // no row between these samples
+            continue;
+        }
+
+        double base = value[i];
+        double increment = 0;
+        if (mode == resample_mode::linear)
+        {
+            const double slope = (value[i + 1] - value[i]) / static_cast<double>(time[i + 1] - time[i]);
+            base += slope * static_cast<double>(static_cast<int64_t>(row) * step - time[i]);
+            increment = slope * static_cast<double>(step);
+        }
+
+        fill_affine(out + row, end - row, base, increment);
+        row = end;
+    }
+
+    if (count == 0 || row >= rows)
+    {
+        return;
+    }
+
+    if (mode == resample_mode::last_value)
+    {
+        std::fill(out + row, out + rows, value[count - 1]);
+        return;
+    }
+
+    // nothing to interpolate towards after the last sample
+    if (static_cast<int64_t>(row) * step == time[count - 1])
+    {
+        out[row++] = value[count - 1];
+    }
+    std::fill(out + row, out + rows, nan);
+}
+
+size_t ColumnarExport::write(const std::string &path, double rate, resample_mode mode, unsigned threads) const
+{
+    const int64_t step = std::max<int64_t>(std::llround(1e9 / rate), 1);
+
+    int64_t first = INT64_MAX;
+    int64_t last = INT64_MIN;
+    for (const series &each : samples)
+    {
+        if (!each.time.empty())
+        {
+            first = std::min(first, each.time.front());
+            last = std::max(last, each.time.back());
+        }
+    }
+
+    const size_t rows = (first <= last) ? static_cast<size_t>((last - first) * 1000 / step + 1) : 0;
+    if (first > last)
+    {
+        first = 0;
+    }
+
+    // header, directory, time column, value columns
+    columnar_header header{};
+    std::memcpy(header.magic, COLUMNS_MAGIC, sizeof(COLUMNS_MAGIC));
+    header.version = COLUMNS_VERSION;
+    header.channels = channels.size();
+    header.rows = rows;
+    header.start = (start + first) * 1000;
+    header.step = step;
+    header.mode = static_cast<uint8_t>(mode);
+    header.time_offset = aligned(sizeof(columnar_header) + channels.size() * sizeof(columnar_channel));
+
+    std::vector<columnar_channel> directory(channels.size());
+    size_t size = aligned(header.time_offset + rows * sizeof(int64_t));
+    for (size_t i = 0; i < channels.size(); i++)
+    {
+        columnar_channel &column = directory[i];
+        column.ecu = channels[i].ecu;
+        column.service = channels[i].service;
+        column.pid = channels[i].pid;
+        column.type = column_float64;
+        column.offset = size;
+        column.samples = samples[i].time.size();
+
+        const pid_info *info = (channels[i].service == obd_service::show_data) ? find_pid(channels[i].pid) : nullptr;
+        if (info != nullptr)
+        {
+            std::strncpy(column.name, info->name, sizeof(column.name) - 1);
+        }
+        else
+        {
+            std::snprintf(column.name, sizeof(column.name), "%02x_%02x", channels[i].service & 0xff, channels[i].pid & 0xffff);
+        }
+
+        size = aligned(size + rows * sizeof(double));
+    }
+
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "Columns open " + path);
+    }
+
+    if (::ftruncate(fd, size) < 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::system_category(), "Columns size");
+    }
+
+    void *mapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::system_error(error, std::system_category(), "Columns map");
+    }
+
+    uint8_t *file = static_cast<uint8_t *>(mapping);
+    std::memcpy(file, &header, sizeof(header));
+    std::memcpy(file + sizeof(header), directory.data(), directory.size() * sizeof(columnar_channel));
+
+    int64_t *times = reinterpret_cast<int64_t *>(file + header.time_offset);
+    for (size_t row = 0; row < rows; row++)
+    {
+        times[row] = header.start + static_cast<int64_t>(row) * step;
+    }
+
+    // channels taken in turn by the threads, each writes its own column
+    std::atomic<size_t> next{};
+    const auto worker = [&]() {
+        std::vector<int64_t> relative;
+        for (size_t i = next.fetch_add(1); i < samples.size(); i = next.fetch_add(1))
+        {
+            const series &each = samples[i];
+
+            relative.resize(each.time.size());
+            for (size_t j = 0; j < each.time.size(); j++)
+            {
+                relative[j] = (each.time[j] - first) * 1000;
+            }
+
+            resample(relative.data(), each.value.data(), each.value.size(), step, rows, mode,
+                reinterpret_cast<double *>(file + directory[i].offset));
+        }
+    };
+
+    if (threads == 0)
+    {
+        threads = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    threads = std::min<size_t>(threads, std::max<size_t>(samples.size(), 1));
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+    {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &thread : pool)
+    {
+        thread.join();
+    }
+
+    ::munmap(mapping, size);
+
+    return rows;
+}
@@ -0,0 +1,86 @@
+#ifndef __COLUMNAR_H
+#define __COLUMNAR_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BinaryLog.hpp"
+
+// Polled samples aligned onto a fixed rate grid, one column per channel, for memory mapping
+//
+//  header:   columnar_header, 64 bytes
+//  channels: one columnar_channel per channel
+//  columns:  the int64 time column (unix nanoseconds), then a float64 column per channel,
+//            little endian, each at a COLUMN_ALIGNMENT aligned offset
+//
+// Rows before the first sample of a channel are NaN, so are the rows after its last sample
+// with linear interpolation. e.g. numpy:
+//  np.frombuffer(data, np.float64, rows, channel['offset'])
+
+static const char COLUMNS_MAGIC[8] = {'O', 'B', 'E', 'Y', 'C', 'O', 'L', '1'};
+static const uint32_t COLUMNS_VERSION = 1;
+static const size_t COLUMN_ALIGNMENT = 64;
+
+enum class resample_mode:uint8_t {last_value, linear};
+enum column_type:uint32_t {column_int64 = 1, column_float64 = 2};
+
+struct columnar_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t channels;
+    uint64_t rows;
+    int64_t start; // unix time of the first row, nanoseconds
+    int64_t step; // nanoseconds between rows
+    uint64_t time_offset; // of the time column
+    uint8_t mode; // resample_mode
+    uint8_t reserved[15];
+};
+static_assert(sizeof(columnar_header) == 64);
+
+struct columnar_channel
+{
+    int32_t ecu;
+    int32_t service;
+    int32_t pid;
+    uint32_t type; // column_type
+    uint64_t offset; // of the column
+    uint64_t samples; // before resampling
+    char name[32];
+};
+static_assert(sizeof(columnar_channel) == 64);
+
+// Collects the samples of a log, then resamples every channel on its own thread
+class ColumnarExport
+{
+    public:
+        // channels of the log dictionary, empty until read for a log that was not closed
+        ColumnarExport(const log_header &header, const std::vector<log_channel> &channels);
+
+        // time in microseconds since the log start, in time order per channel
+        void sample(uint32_t channel, uint64_t time, double value);
+
+        // the dictionary as rebuilt by reading, before write
+        void define(const std::vector<log_channel> &dictionary);
+
+        // grid from the first to the last sample, threads 0 = one per core; returns the rows
+        size_t write(const std::string &path, double rate, resample_mode mode, unsigned threads = 0) const;
+
+        // rows at row * step nanoseconds, time in nanoseconds relative to the first row
+        static void resample(const int64_t *time, const double *value, size_t count,
+            int64_t step, size_t rows, resample_mode mode, double *out);
+
+    private:
+        struct series
+        {
+            std::vector<int64_t> time; // microseconds since the log start
+            std::vector<double> value;
+        };
+
+        const int64_t start; // of the log, unix microseconds
+        std::vector<log_channel> channels;
+        std::vector<series> samples;
+};
+
+#endif // __COLUMNAR_H
@@ -0,0 +1,225 @@
+#include "DTC.hpp"
+#include "OBDDescriptor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// First 3 characters of the text by the high byte of the code ("U01" for 0xc1), then NUL
+static constexpr auto DTC_HIGH = []() {
+    constexpr std::string_view systems = "PCBU";
+    constexpr std::string_view digits = "0123456789ABCDEF";
+
+    std::array<std::array<char, 4>, 256> table{};
+    for (size_t high = 0; high < table.size(); high++)
+    {
+        table[high] = {systems[high >> 6], static_cast<char>('0' + ((high >> 4) & 0x03)), digits[high & 0x0f], '\0'};
+    }
+    return table;
+}();
+
+// Last 2 characters by the low byte
+static constexpr auto DTC_LOW = []() {
+    constexpr std::string_view digits = "0123456789ABCDEF";
+
+    std::array<std::array<char, 2>, 256> table{};
+    for (size_t low = 0; low < table.size(); low++)
+    {
+        table[low] = {digits[low >> 4], digits[low & 0x0f]};
+    }
+    return table;
+}();
+
+static_assert(DTC_HIGH[0xc1][0] == 'U' && DTC_HIGH[0xc1][1] == '0' && DTC_HIGH[0xc1][2] == '1' && DTC_LOW[0x58][1] == '8');
+
+// Every code formats to text that parses back to it. dtc_code() reads the high byte from the
+// first 3 characters and the low byte from the last 2, so checking each table against it
+// covers all 65536 codes
+static_assert([]() {
+    for (uint32_t byte = 0; byte <= 0xff; byte++)
+    {
+        const char high[5] = {DTC_HIGH[byte][0], DTC_HIGH[byte][1], DTC_HIGH[byte][2], '0', '0'};
+        const char low[5] = {'P', '0', '0', DTC_LOW[byte][0], DTC_LOW[byte][1]};
+        if (dtc_code(std::string_view{high, sizeof(high)}) != byte << 8 || dtc_code(std::string_view{low, sizeof(low)}) != byte)
+        {
+            return false;
+        }
+    }
+    return true;
+}(), "DTC tables do not round trip");
+
+struct dtc_text
+{
+    std::string_view code;
+    const char *description;
+};
+
+// Common generic (SAE J2012) codes
+static constexpr dtc_text DESCRIPTION_TEXT[] = {
+    {"P0100", "Mass or volume air flow circuit malfunction"},
+    {"P0101", "Mass or volume air flow circuit range/performance"},
+    {"P0102", "Mass or volume air flow circuit low input"},
+    {"P0103", "Mass or volume air flow circuit high input"},
+    {"P0110", "Intake air temperature circuit malfunction"},
+    {"P0115", "Engine coolant temperature circuit malfunction"},
+    {"P0117", "Engine coolant temperature circuit low input"},
+    {"P0118", "Engine coolant temperature circuit high input"},
+    {"P0120", "Throttle position sensor A circuit malfunction"},
+    {"P0128", "Coolant temperature below thermostat regulating temperature"},
+    {"P0130", "O2 sensor circuit malfunction (bank 1 sensor 1)"},
+    {"P0133", "O2 sensor circuit slow response (bank 1 sensor 1)"},
+    {"P0171", "System too lean (bank 1)"},
+    {"P0172", "System too rich (bank 1)"},
+    {"P0174", "System too lean (bank 2)"},
+    {"P0175", "System too rich (bank 2)"},
+    {"P0300", "Random/multiple cylinder misfire detected"},
+    {"P0301", "Cylinder 1 misfire detected"},
+    {"P0302", "Cylinder 2 misfire detected"},
+    {"P0303", "Cylinder 3 misfire detected"},
+    {"P0304", "Cylinder 4 misfire detected"},
+    {"P0305", "Cylinder 5 misfire detected"},
+    {"P0306", "Cylinder 6 misfire detected"},
+    {"P0307", "Cylinder 7 misfire detected"},
+    {"P0308", "Cylinder 8 misfire detected"},
+    {"P0325", "Knock sensor 1 circuit malfunction"},
+    {"P0335", "Crankshaft position sensor A circuit malfunction"},
+    {"P0340", "Camshaft position sensor circuit malfunction"},
+    {"P0400", "Exhaust gas recirculation flow malfunction"},
+    {"P0401", "Exhaust gas recirculation flow insufficient"},
+    {"P0420", "Catalyst system efficiency below threshold (bank 1)"},
+    {"P0430", "Catalyst system efficiency below threshold (bank 2)"},
+    {"P0440", "Evaporative emission control system malfunction"},
+    {"P0442", "Evaporative emission control system small leak detected"},
+    {"P0446", "Evaporative emission control system vent control circuit malfunction"},
+    {"P0455", "Evaporative emission control system large leak detected"},
+    {"P0500", "Vehicle speed sensor malfunction"},
+    {"P0505", "Idle control system malfunction"},
+    {"P0562", "System voltage low"},
+    {"P0563", "System voltage high"},
+    {"P0600", "Serial communication link malfunction"},
+    {"P0700", "Transmission control system malfunction"},
+    {"U0001", "High speed CAN communication bus"},
+    {"U0100", "Lost communication with ECM/PCM A"},
+    {"U0101", "Lost communication with TCM"},
+    {"U0121", "Lost communication with anti-lock brake system control module"},
+    {"U0140", "Lost communication with body control module"},
+    {"U0151", "Lost communication with restraints control module"},
+    {"U0155", "Lost communication with instrument panel cluster control module"},
+};
+
+struct dtc_description_entry
+{
+    uint16_t code;
+    const char *description;
+};
+
+// Sorted by code for binary search
+static constexpr auto DESCRIPTIONS = []() {
+    std::array<dtc_description_entry, std::size(DESCRIPTION_TEXT)> table{};
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        table[i] = {dtc_code(DESCRIPTION_TEXT[i].code), DESCRIPTION_TEXT[i].description};
+    }
+    std::sort(table.begin(), table.end(), [](const auto &a, const auto &b) { return a.code < b.code; });
+    return table;
+}();
+
+static_assert(std::all_of(std::begin(DESCRIPTION_TEXT), std::end(DESCRIPTION_TEXT),
+    [](const dtc_text &each) { return dtc_code(each.code) != 0; }), "Malformed code in the description table");
+static_assert(std::adjacent_find(DESCRIPTIONS.begin(), DESCRIPTIONS.end(),
+    [](const auto &a, const auto &b) { return a.code == b.code; }) == DESCRIPTIONS.end(), "Duplicate code in the description table");
+
+// Text of a code, two table lookups
+static inline void dtc_format(uint16_t code, char *text)
+{
+    std::memcpy(text, DTC_HIGH[code >> 8].data(), 4);
+    std::memcpy(text + 3, DTC_LOW[code & 0xff].data(), 2);
+    std::memset(text + 5, 0, 3);
+}
+
+uint8_t dtc_status(int service)
+{
+    switch (service)
+    {
+    case obd_service::stored_dtc:
+    case obd_service::permanent_dtc:
+        return DTC_CONFIRMED;
+    case obd_service::pending_dtc:
+        return DTC_PENDING;
+    default:
+        return 0;
+    }
+}
+
+const char *dtc_description(uint16_t code)
+{
+    const auto found = std::lower_bound(DESCRIPTIONS.begin(), DESCRIPTIONS.end(), code,
+        [](const dtc_description_entry &entry, uint16_t value) { return entry.code < value; });
+
+    return (found != DESCRIPTIONS.end() && found->code == code) ? found->description : nullptr;
+}
+
+void dtc_set(std::span<const dtc_entry> dtcs, std::vector<uint16_t> &set)
+{
+    set.clear();
+    for (const dtc_entry &dtc : dtcs)
+    {
+        if (dtc.code != 0)
+        {
+            set.push_back(dtc.code);
+        }
+    }
+
+    std::sort(set.begin(), set.end());
+    set.erase(std::unique(set.begin(), set.end()), set.end());
+}
+
+DTCDecoder::DTCDecoder(size_t capacity)
+: entries(capacity)
+{
+}
+
+dtc_entry *DTCDecoder::reserve(size_t count)
+{
+    if (entries.size() < count)
+    {
+        // only a payload larger than every one before
+        entries.resize(count);
+    }
+    return entries.data();
+}
+
+std::span<const dtc_entry> DTCDecoder::decode(std::span<const uint8_t> response, uint8_t status)
+{
+    // ISO 15765-4 responses carry the number of DTCs after the service,
+    // the pairs following it leave an odd length after the service byte
+    const size_t first = std::min<size_t>((response.size() % 2 == 0) ? 2 : 1, response.size());
+    const uint8_t *data = response.data() + first;
+    const size_t count = (response.size() - first) / 2;
+
+    dtc_entry *out = reserve(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint16_t code = static_cast<uint16_t>(data[2 * i] << 8 | data[2 * i + 1]);
+        out[i].code = code;
+        out[i].failure_type = 0;
+        out[i].status = status;
+        dtc_format(code, out[i].text);
+    }
+
+    return {out, count};
+}
+
+std::span<const dtc_entry> DTCDecoder::decode(std::span<const uint16_t> codes, uint8_t status)
+{
+    dtc_entry *out = reserve(codes.size());
+    for (size_t i = 0; i < codes.size(); i++)
+    {
+        out[i].code = codes[i];
+        out[i].failure_type = 0;
+        out[i].status = status;
+        dtc_format(codes[i], out[i].text);
+    }
+
+    return {out, codes.size()};
+}
@@ -0,0 +1,78 @@
+#ifndef __DTC_H
+#define __DTC_H
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+// DTC status bits (ISO 14229 statusOfDTC)
+static const uint8_t DTC_TEST_FAILED = 0x01;
+static const uint8_t DTC_PENDING = 0x04;
+static const uint8_t DTC_CONFIRMED = 0x08;
+
+struct dtc_entry
+{
+    uint16_t code; // as sent, 0xc158 = U0158
+    uint8_t failure_type; // third byte of ISO 14229 DTCs, 0 for OBD-II
+    uint8_t status; // DTC_* bits
+    char text[8]; // "U0158", NUL padded
+};
+static_assert(sizeof(dtc_entry) == 12);
+
+// 16-bit code of e.g. "P0300", 0 when malformed
+constexpr uint16_t dtc_code(std::string_view text)
+{
+    constexpr std::string_view systems = "PCBU";
+    constexpr std::string_view digits = "0123456789ABCDEF";
+
+    if (text.size() != 5 || systems.find(text[0]) == std::string_view::npos || text[1] < '0' || text[1] > '3')
+    {
+        return 0;
+    }
+
+    uint16_t code = static_cast<uint16_t>(systems.find(text[0]) << 14 | (text[1] - '0') << 12);
+    for (size_t i = 2; i < 5; i++)
+    {
+        const size_t nibble = digits.find(text[i]);
+        if (nibble == std::string_view::npos)
+        {
+            return 0;
+        }
+        code |= nibble << (4 * (4 - i));
+    }
+
+    return code;
+}
+static_assert(dtc_code("U0158") == 0xc158 && dtc_code("P0300") == 0x0300);
+
+// Status implied by the OBD-II service the DTCs came from (0x03, 0x07, 0x0a)
+uint8_t dtc_status(int service);
+
+// SAE J2012 description of a generic code, nullptr when not in the table
+const char *dtc_description(uint16_t code);
+
+// Decodes whole payloads into a buffer kept from call to call, by table lookups without
+// branches or allocations per code. The span is valid until the next decode.
+class DTCDecoder
+{
+    public:
+        DTCDecoder(size_t capacity = 256);
+
+        // 0x43/0x47/0x4a response, with or without the count byte, status for all of its codes
+        std::span<const dtc_entry> decode(std::span<const uint8_t> response, uint8_t status = 0);
+
+        // codes already parsed, e.g. the DTC sets of watch-faults
+        std::span<const dtc_entry> decode(std::span<const uint16_t> codes, uint8_t status = 0);
+
+    private:
+        dtc_entry *reserve(size_t count);
+
+        std::vector<dtc_entry> entries;
+};
+
+// Sorted, unique codes of decoded DTCs, without the 0x0000 padding of older ECUs;
+// set is overwritten and keeps its capacity
+void dtc_set(std::span<const dtc_entry> dtcs, std::vector<uint16_t> &set);
+
+#endif // __DTC_H
@@ -0,0 +1,36 @@
+#include "DeltaFilter.hpp"
+
+#include <cmath>
+
+DeltaFilter::DeltaFilter(std::chrono::milliseconds heartbeat)
+: heartbeat{ heartbeat }
+{
+}
+
+void DeltaFilter::deadband(int pid, double band)
+{
+    channels[pid & 0xff].band = std::fabs(band);
+}
+
+bool DeltaFilter::update(int pid, double value, std::chrono::steady_clock::time_point now)
+{
+    channel &each = channels[pid & 0xff];
+
+    // compared to the last emitted value, a slow drift still gets through
+    const double delta = std::fabs(value - each.last);
+    const bool changed = !each.seen || ((each.band > 0) ? (delta > each.band) : (value != each.last));
+    const bool beat = heartbeat.count() > 0 && now - each.emitted >= heartbeat;
+
+    if (!changed && !beat)
+    {
+        dropped++;
+        return false;
+    }
+
+    each.last = value;
+    each.emitted = now;
+    each.seen = true;
+    passed++;
+
+    return true;
+}
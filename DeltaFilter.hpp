@@ -0,0 +1,43 @@
+#ifndef __DELTA_FILTER_H
+#define __DELTA_FILTER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+// Change-only streaming of PID values
+// A value passes when it moved beyond the deadband of its PID since the last
+// value that passed, or when the heartbeat is due. A deadband of 0 passes any change.
+class DeltaFilter
+{
+    public:
+        // heartbeat 0 = never
+        DeltaFilter(std::chrono::milliseconds heartbeat = {});
+
+        void deadband(int pid, double band);
+
+        // true when the value is to be emitted
+        bool update(int pid, double value, std::chrono::steady_clock::time_point now);
+
+        uint64_t emitted() const { return passed; }
+        uint64_t suppressed() const { return dropped; }
+
+    private:
+        struct channel
+        {
+            double band;
+            double last;
+            std::chrono::steady_clock::time_point emitted;
+            bool seen;
+        };
+
+        const std::chrono::milliseconds heartbeat;
+
+        // indexed by PID, standard PIDs only
+        std::array<channel, 0x100> channels{};
+
+        uint64_t passed{};
+        uint64_t dropped{};
+};
+
+#endif // __DELTA_FILTER_H
@@ -1,46 +1,115 @@
 #include "ISO15765.hpp"
-#include <iostream>
+#include "Trace.hpp"
 
-bool ISO15765Decoder::add_fragment(const std::array<uint8_t, 8> &data)
+static const int SINGLE_FRAME_MAX = 7;
+static const int CONSECUTIVE_DATA = 7;
+static const int SEQUENCE_MASK = 0x0f;
+static const int FIRST_FRAME_MIN = 8; // shorter messages are single frames
+
+ISO15765Decoder::ISO15765Decoder(const ISO15765FlowControl &flow_control)
+: config{ flow_control }
 {
-    // returns true when final piece received
+}
+
+bool ISO15765Decoder::add_fragment(const std::array<uint8_t, 8> &data, uint32_t id)
+{
+    // returns true when more pieces are expected
 
     const header_type type = static_cast<header_type>(data[0] >> 4);
+    done = false;
 
     if (type == header_type::single)
     {
-        length = data[0] & 0x07;
+        length = std::min(data[0] & 0x0f, SINGLE_FRAME_MAX);
 
         std::copy(data.cbegin() + 1, data.cbegin() + length + 1, defragmented.begin());
 
+        index = length;
+        receiving = false;
+        done = true;
+        OBEY_TRACE_EVENT(trace_type::isotp_state, id, trace_isotp::single_frame, length, 0);
+        pending_flow_control = false;
+        refused = false;
+
         return false;
     }
     else if (type == header_type::first)
     {
         length = data[1] | (data[0] & 0x0f) << 8;
 
+        index = 0;
+        last = 0;
+        block = 0;
+        missed_frames = 0;
+        waits = config.wait_frames;
+        pending_flow_control = true;
+        flow_control_at = {};
+
+        if (length < FIRST_FRAME_MIN)
+        {
+            // invalid, ignored without a flow control
+            OBEY_TRACE_EVENT(trace_type::isotp_state, id, trace_isotp::invalid, length, 0);
+            length = 0;
+            receiving = false;
+            pending_flow_control = false;
+            return false;
+        }
+
+        refused = (length > config.max_length);
+        if (refused)
+        {
+            OBEY_TRACE_EVENT(trace_type::isotp_state, id, trace_isotp::refused, length, 0);
+            // answered with OVERFLOW, the sender aborts
+            receiving = false;
+            return false;
+        }
+
         std::copy(data.cbegin() + 2, data.cend(), defragmented.begin());
 
         index = data.size() - 2;
-        last = 0;
+        receiving = true;
+        OBEY_TRACE_EVENT(trace_type::isotp_state, id, trace_isotp::first_frame, length, index);
 
         return true;
     }
     else if (type == header_type::consecutive)
     {
-        const int seq = data[0] & 0x0f;
-        if (seq != last + 1)
+        if (!receiving)
         {
-            std::cerr << "WARNING: missed ISO15765 frame with sequence " << (last + 1) << std::endl;
-            index += 7;
+            // no first frame seen
+            return false;
         }
 
-        std::copy(data.cbegin() + 1, data.cend(), defragmented.begin() + index);
-        index += (data.size() - 1);
+        // the sequence wraps from 0xf to 0x0
+        const int seq = data[0] & SEQUENCE_MASK;
+        const int expected = (last + 1) & SEQUENCE_MASK;
+        if (seq != expected)
+        {
+            const int skipped = (seq - expected) & SEQUENCE_MASK;
+            OBEY_TRACE_EVENT(trace_type::isotp_state, id, trace_isotp::sequence_missed, seq, index);
+            missed_frames += skipped;
+            index += CONSECUTIVE_DATA * skipped;
+        }
+
+        const int count = std::max(0, std::min(CONSECUTIVE_DATA, length - index));
+        std::copy(data.cbegin() + 1, data.cbegin() + 1 + count, defragmented.begin() + std::min(index, length));
+        index += CONSECUTIVE_DATA;
 
         last = seq;
+        receiving = (index < length);
+        done = !receiving;
+        OBEY_TRACE_EVENT(trace_type::isotp_state, id, receiving ? trace_isotp::consecutive_frame : trace_isotp::complete, seq, index);
 
-        return (index < length);
+        if (receiving && config.block_size > 0 && ++block >= config.block_size)
+        {
+            // end of block, acknowledge for the next one
+            block = 0;
+            waits = config.wait_frames;
+            pending_flow_control = true;
+            flow_control_at = {};
+        }
+
+        return receiving;
     }
 
     // flow control, do nothing
@@ -48,7 +117,42 @@ bool ISO15765Decoder::add_fragment(const std::array<uint8_t, 8> &data)
     return false;
 }
 
+const std::array<uint8_t, 8> ISO15765Decoder::flow_control_frame()
+{
+    std::array<uint8_t, 8> frame{};
+
+    flow_status status = flow_status::clear_to_send;
+    if (refused)
+    {
+        status = flow_status::overflow;
+        pending_flow_control = false;
+    }
+    else if (waits > 0)
+    {
+        // still due, clear to send follows
+        status = flow_status::wait;
+        waits--;
+        flow_control_at = std::chrono::steady_clock::now() + config.wait_interval;
+    }
+    else
+    {
+        pending_flow_control = false;
+    }
+
+    frame[0] = (header_type::flow << 4) | status;
+    frame[1] = config.block_size;
+    frame[2] = config.st_min;
+
+    return frame;
+}
+
 const std::vector<uint8_t> ISO15765Decoder::get_data() const
 {
+    if (refused || missed_frames > 0 || index < length)
+    {
+        // incomplete or corrupted
+        return {};
+    }
+
     return std::vector<uint8_t>(defragmented.cbegin(), defragmented.cbegin() + length);
 }
@@ -2,27 +2,62 @@
 #define __ISO15765_H
 
 #include <array>
+#include <chrono>
 #include <cstdint>
 #include <vector>
 
 static const int MAX_LENGTH = 4095;
 enum header_type:uint8_t {single, first, consecutive, flow};
+enum flow_status:uint8_t {clear_to_send, wait, overflow};
 static const int ISO15765_DATA_OFFSET = 2;
 
+// Flow control parameters sent by the receiver of a multi-frame message
+struct ISO15765FlowControl
+{
+    uint8_t block_size{}; // consecutive frames between flow control frames, 0 = no limit
+    uint8_t st_min{}; // separation time, 0x00-0x7f ms or 0xf1-0xf9 100-900us
+    int wait_frames{}; // WAIT frames sent ahead of each clear to send
+    std::chrono::milliseconds wait_interval{100}; // after each WAIT frame, well under the sender's N_Bs (1s)
+    int max_length{MAX_LENGTH}; // longer messages are refused with OVERFLOW
+};
+
 class ISO15765Decoder
 {
     public:
-        ISO15765Decoder() = default;
+        ISO15765Decoder(const ISO15765FlowControl &flow_control = {});
         ~ISO15765Decoder() = default;
 
-        bool add_fragment(const std::array<uint8_t, 8> &data);
+        bool add_fragment(const std::array<uint8_t, 8> &data, uint32_t id = 0); // id of the frame, for tracing
         const std::vector<uint8_t> get_data() const;
 
+        // A flow control frame must be sent before the sender continues
+        // WAIT frames are due wait_interval apart, the caller checks again while waiting
+        bool flow_control_due() const
+        {
+            return pending_flow_control && std::chrono::steady_clock::now() >= flow_control_at;
+        }
+        const std::array<uint8_t, 8> flow_control_frame();
+
+        int missed() const { return missed_frames; }
+
+        // The last fragment completed a message
+        bool completed() const { return done; }
+
     private:
+        ISO15765FlowControl config;
+
         std::array<uint8_t, MAX_LENGTH> defragmented{};
         int length{}; // expected total length
         int index{}; // offset in buffer
         int last{}; // Last sequence
+        int block{}; // consecutive frames received in the current block
+        int waits{}; // WAIT frames left before clear to send
+        int missed_frames{};
+        bool receiving{};
+        bool pending_flow_control{};
+        bool refused{};
+        bool done{};
+        std::chrono::steady_clock::time_point flow_control_at{}; // next flow control frame
 };
 
 #endif //__ISO15765_H
@@ -0,0 +1,294 @@
+#include "Metrics.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+static std::mutex registry_lock;
+static std::vector<std::shared_ptr<MetricsShard>> registry;
+
+static const auto started = std::chrono::steady_clock::now();
+static std::string metrics_path;
+static volatile std::sig_atomic_t dump_requested = 0;
+static std::atomic<double> load_percent{};
+
+static void dump_handler(int)
+{
+    dump_requested = 1;
+}
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency)
+{
+    const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+
+    size_t bucket = 0;
+    while (bucket < BOUNDS_US.size() && us > BOUNDS_US[bucket])
+    {
+        bucket++;
+    }
+
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(latency.count(), std::memory_order_relaxed);
+}
+
+MetricsShard &Metrics::shard()
+{
+    thread_local std::shared_ptr<MetricsShard> local = []() {
+        auto created = std::make_shared<MetricsShard>();
+
+        // kept after the thread exits, so its counts remain in the totals
+        std::lock_guard<std::mutex> lock{registry_lock};
+        registry.push_back(created);
+
+        return created;
+    }();
+
+    return *local;
+}
+
+void Metrics::frame(frame_direction direction)
+{
+    shard().frames[static_cast<int>(direction)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::latency(int ecu, int service, int pid, std::chrono::nanoseconds elapsed)
+{
+    MetricsShard &local = shard();
+    const auto key = std::make_tuple(ecu, service, pid);
+
+    // lookups need no lock, only this thread inserts
+    auto found = local.latency.find(key);
+    if (found == local.latency.end())
+    {
+        std::lock_guard<std::mutex> lock{local.latency_lock};
+        found = local.latency.emplace(key, std::make_unique<LatencyHistogram>()).first;
+    }
+
+    found->second->record(elapsed);
+}
+
+void Metrics::reassembly(bool complete)
+{
+    auto &counter = complete ? shard().reassembled : shard().reassembly_failed;
+    counter.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::missed_frames(int count)
+{
+    if (count > 0)
+    {
+        shard().missed_frames.fetch_add(count, std::memory_order_relaxed);
+    }
+}
+
+void Metrics::timeout()
+{
+    shard().timeouts.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::negative_response()
+{
+    shard().negative_responses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::throttle(std::chrono::nanoseconds waited)
+{
+    shard().throttled.fetch_add(1, std::memory_order_relaxed);
+    shard().throttled_ns.fetch_add(waited.count(), std::memory_order_relaxed);
+}
+
+void Metrics::bus_load(double percent)
+{
+    load_percent.store(percent, std::memory_order_relaxed);
+}
+
+const std::string Metrics::prometheus()
+{
+    std::array<uint64_t, 2> frames{};
+    uint64_t reassembled = 0;
+    uint64_t reassembly_failed = 0;
+    uint64_t missed_frames = 0;
+    uint64_t timeouts = 0;
+    uint64_t negative_responses = 0;
+    uint64_t throttled = 0;
+    uint64_t throttled_ns = 0;
+
+    struct merged_histogram
+    {
+        std::array<uint64_t, LatencyHistogram::BOUNDS_US.size() + 1> counts{};
+        uint64_t total_ns{};
+    };
+    std::map<std::tuple<int, int, int>, merged_histogram> latency;
+
+    {
+        std::lock_guard<std::mutex> lock{registry_lock};
+        for (const auto &each : registry)
+        {
+            for (size_t i = 0; i < frames.size(); i++)
+            {
+                frames[i] += each->frames[i].load(std::memory_order_relaxed);
+            }
+            reassembled += each->reassembled.load(std::memory_order_relaxed);
+            reassembly_failed += each->reassembly_failed.load(std::memory_order_relaxed);
+            missed_frames += each->missed_frames.load(std::memory_order_relaxed);
+            timeouts += each->timeouts.load(std::memory_order_relaxed);
+            negative_responses += each->negative_responses.load(std::memory_order_relaxed);
+            throttled += each->throttled.load(std::memory_order_relaxed);
+            throttled_ns += each->throttled_ns.load(std::memory_order_relaxed);
+
+            std::lock_guard<std::mutex> latency_lock{each->latency_lock};
+            for (const auto &[key, histogram] : each->latency)
+            {
+                merged_histogram &merged = latency[key];
+                for (size_t i = 0; i < merged.counts.size(); i++)
+                {
+                    merged.counts[i] += histogram->counts[i].load(std::memory_order_relaxed);
+                }
+                merged.total_ns += histogram->total_ns.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    const double uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    const char *directions[] = {"rx", "tx"};
+
+    std::ostringstream out;
+
+    out << "# HELP obey_uptime_seconds Time since the process started\n"
+        << "# TYPE obey_uptime_seconds gauge\n"
+        << "obey_uptime_seconds " << uptime << "\n";
+
+    out << "# HELP obey_can_frames_total CAN frames received and sent\n"
+        << "# TYPE obey_can_frames_total counter\n";
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        out << "obey_can_frames_total{direction=\"" << directions[i] << "\"} " << frames[i] << "\n";
+    }
+
+    out << "# HELP obey_can_frames_per_second Average CAN frame rate since the process started\n"
+        << "# TYPE obey_can_frames_per_second gauge\n";
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        out << "obey_can_frames_per_second{direction=\"" << directions[i] << "\"} "
+            << ((uptime > 0) ? (frames[i] / uptime) : 0) << "\n";
+    }
+
+    out << "# HELP obey_isotp_reassembly_total ISO 15765 multi-frame messages by result\n"
+        << "# TYPE obey_isotp_reassembly_total counter\n"
+        << "obey_isotp_reassembly_total{result=\"complete\"} " << reassembled << "\n"
+        << "obey_isotp_reassembly_total{result=\"failed\"} " << reassembly_failed << "\n";
+
+    out << "# HELP obey_isotp_missed_frames_total Consecutive frames lost by a sequence gap\n"
+        << "# TYPE obey_isotp_missed_frames_total counter\n"
+        << "obey_isotp_missed_frames_total " << missed_frames << "\n";
+
+    out << "# HELP obey_timeouts_total Requests without a response before the wait expired\n"
+        << "# TYPE obey_timeouts_total counter\n"
+        << "obey_timeouts_total " << timeouts << "\n";
+
+    out << "# HELP obey_negative_responses_total Negative responses (0x7f) from ECUs\n"
+        << "# TYPE obey_negative_responses_total counter\n"
+        << "obey_negative_responses_total " << negative_responses << "\n";
+
+    out << "# HELP obey_bus_load_percent Estimated CAN bus load, with request pacing\n"
+        << "# TYPE obey_bus_load_percent gauge\n"
+        << "obey_bus_load_percent " << load_percent.load(std::memory_order_relaxed) << "\n";
+
+    out << "# HELP obey_requests_throttled_total Requests delayed to stay under the bus load target\n"
+        << "# TYPE obey_requests_throttled_total counter\n"
+        << "obey_requests_throttled_total " << throttled << "\n";
+
+    out << "# HELP obey_throttled_seconds_total Time requests were delayed\n"
+        << "# TYPE obey_throttled_seconds_total counter\n"
+        << "obey_throttled_seconds_total " << (throttled_ns / 1e9) << "\n";
+
+    out << "# HELP obey_request_latency_seconds Request to complete response\n"
+        << "# TYPE obey_request_latency_seconds histogram\n";
+    for (const auto &[key, histogram] : latency)
+    {
+        const auto [ecu, service, pid] = key;
+
+        char labels[64];
+        ::snprintf(labels, sizeof(labels), "ecu=\"%d\",service=\"0x%02x\",pid=\"0x%02x\"", ecu, service, pid);
+
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < histogram.counts.size(); i++)
+        {
+            cumulative += histogram.counts[i];
+
+            out << "obey_request_latency_seconds_bucket{" << labels << ",le=\"";
+            if (i < LatencyHistogram::BOUNDS_US.size())
+            {
+                out << (LatencyHistogram::BOUNDS_US[i] / 1e6);
+            }
+            else
+            {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+
+        out << "obey_request_latency_seconds_sum{" << labels << "} " << (histogram.total_ns / 1e9) << "\n"
+            << "obey_request_latency_seconds_count{" << labels << "} " << cumulative << "\n";
+    }
+
+    return out.str();
+}
+
+void Metrics::export_path(const std::string &path)
+{
+    metrics_path = path;
+}
+
+void Metrics::write()
+{
+    if (metrics_path.empty())
+    {
+        return;
+    }
+
+    const std::string text = prometheus();
+    const std::string temporary = metrics_path + ".tmp";
+
+    FILE *file = ::fopen(temporary.c_str(), "w");
+    if (file == nullptr)
+    {
+        throw std::system_error(errno, std::system_category(), "Metrics");
+    }
+
+    const bool written = (::fwrite(text.data(), 1, text.size(), file) == text.size());
+    if (::fclose(file) != 0 || !written)
+    {
+        // e.g. a full disk, the last complete export stays in place
+        const int error = errno;
+        std::remove(temporary.c_str());
+        throw std::system_error(error, std::system_category(), "Metrics write");
+    }
+
+    if (::rename(temporary.c_str(), metrics_path.c_str()) < 0)
+    {
+        throw std::system_error(errno, std::system_category(), "Metrics");
+    }
+}
+
+void Metrics::install_signal()
+{
+    struct sigaction act{};
+    act.sa_handler = dump_handler;
+    ::sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    ::sigaction(SIGUSR1, &act, nullptr);
+}
+
+bool Metrics::poll()
+{
+    if (!dump_requested)
+    {
+        return false;
+    }
+
+    dump_requested = 0;
+    return true;
+}
@@ -0,0 +1,74 @@
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+enum class frame_direction:uint8_t {rx, tx};
+
+class LatencyHistogram
+{
+    public:
+        // upper bounds of the buckets in microseconds, the last bucket is +Inf
+        static constexpr std::array<int64_t, 15> BOUNDS_US =
+            {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000};
+
+        void record(std::chrono::nanoseconds latency);
+
+        std::array<std::atomic<uint64_t>, BOUNDS_US.size() + 1> counts{};
+        std::atomic<uint64_t> total_ns{};
+};
+
+// Counters of one thread, only the owning thread writes to them
+struct MetricsShard
+{
+    std::array<std::atomic<uint64_t>, 2> frames{};
+    std::atomic<uint64_t> reassembled{};
+    std::atomic<uint64_t> reassembly_failed{};
+    std::atomic<uint64_t> missed_frames{};
+    std::atomic<uint64_t> timeouts{};
+    std::atomic<uint64_t> negative_responses{};
+    std::atomic<uint64_t> throttled{};
+    std::atomic<uint64_t> throttled_ns{};
+
+    // (ecu, service, pid), entries are added under the lock and never removed
+    std::mutex latency_lock;
+    std::map<std::tuple<int, int, int>, std::unique_ptr<LatencyHistogram>> latency;
+};
+
+// Process wide metrics, updated through per-thread shards without locks
+class Metrics
+{
+    public:
+        static void frame(frame_direction direction);
+        static void latency(int ecu, int service, int pid, std::chrono::nanoseconds elapsed);
+        static void reassembly(bool complete);
+        static void missed_frames(int count);
+        static void timeout();
+        static void negative_response();
+        static void throttle(std::chrono::nanoseconds waited);
+        static void bus_load(double percent);
+
+        // Prometheus text exposition format
+        static const std::string prometheus();
+
+        // Written to a temporary file and renamed, for the node exporter textfile collector
+        static void export_path(const std::string &path);
+        static void write();
+
+        // SIGUSR1 requests a dump, poll() returns true once per request, outside the signal handler
+        static void install_signal();
+        static bool poll();
+
+    private:
+        static MetricsShard &shard();
+};
+
+#endif // __METRICS_H
@@ -0,0 +1,132 @@
+#include "OBD.hpp"
+
+#include <algorithm>
+
+#include <linux/can.h>
+
+static const uint32_t OBD_BROADCAST = 0x7df;
+static const uint32_t OBD_ECU_SEND_BASE = 0x7e0;
+static const uint32_t OBD_ECU_RECV_BASE = OBD_ECU_SEND_BASE + 8;
+static const int OBD_MAX_ECUS = 8;
+
+static const uint32_t OBD_BROADCAST_29 = 0x18db33f1;
+static const uint32_t OBD_ECU_SEND_BASE_29 = 0x18da00f1; // target address in bits 8-15
+static const uint32_t OBD_ECU_RECV_BASE_29 = 0x18daf100; // source address in bits 0-7
+static const int OBD_MAX_ECUS_29 = 0x100;
+
+OBDAddressing::OBDAddressing(bool extended)
+: is_extended{ extended }
+{
+}
+
+int OBDAddressing::max_ecus() const
+{
+    return is_extended ? OBD_MAX_ECUS_29 : OBD_MAX_ECUS;
+}
+
+uint32_t OBDAddressing::broadcast_id() const
+{
+    return is_extended ? (OBD_BROADCAST_29 | CAN_EFF_FLAG) : OBD_BROADCAST;
+}
+
+uint32_t OBDAddressing::request_id(int ecu) const
+{
+    if (is_extended)
+    {
+        return OBD_ECU_SEND_BASE_29 | (static_cast<uint32_t>(ecu & 0xff) << 8) | CAN_EFF_FLAG;
+    }
+
+    return OBD_ECU_SEND_BASE + (ecu & 0x07);
+}
+
+uint32_t OBDAddressing::response_id(int ecu) const
+{
+    if (is_extended)
+    {
+        return OBD_ECU_RECV_BASE_29 | static_cast<uint32_t>(ecu & 0xff) | CAN_EFF_FLAG;
+    }
+
+    return OBD_ECU_RECV_BASE + (ecu & 0x07);
+}
+
+uint32_t OBDAddressing::response_mask() const
+{
+    return is_extended ? (CAN_EFF_MASK & ~0xff) : (CAN_SFF_MASK & ~0x07);
+}
+
+int OBDAddressing::ecu_of_response(uint32_t id) const
+{
+    if (is_extended)
+    {
+        if (!(id & CAN_EFF_FLAG) || (id & CAN_EFF_MASK & ~0xff) != OBD_ECU_RECV_BASE_29)
+        {
+            return ANY_ECU;
+        }
+
+        return id & 0xff;
+    }
+
+    if ((id & CAN_EFF_FLAG) || (id & ~0x07) != OBD_ECU_RECV_BASE)
+    {
+        return ANY_ECU;
+    }
+
+    return id & 0x07;
+}
+
+uint32_t OBDAddressing::request_for_response(uint32_t id) const
+{
+    const int ecu = ecu_of_response(id);
+    return (ecu == ANY_ECU) ? broadcast_id() : request_id(ecu);
+}
+
+bool OBDAddressing::is_broadcast(uint32_t id) const
+{
+    return id == broadcast_id();
+}
+
+int OBDAddressing::ecu_of_request(uint32_t id) const
+{
+    if (is_extended)
+    {
+        if (!(id & CAN_EFF_FLAG) || (id & CAN_EFF_MASK & ~0xff00) != OBD_ECU_SEND_BASE_29)
+        {
+            return ANY_ECU;
+        }
+
+        return (id >> 8) & 0xff;
+    }
+
+    if ((id & CAN_EFF_FLAG) || (id & ~0x07) != OBD_ECU_SEND_BASE)
+    {
+        return ANY_ECU;
+    }
+
+    return id & 0x07;
+}
+
+void diff_dtcs(const std::vector<uint16_t> &before, const std::vector<uint16_t> &after,
+    std::vector<uint16_t> &appeared, std::vector<uint16_t> &cleared)
+{
+    appeared.clear();
+    cleared.clear();
+
+    auto old_dtc = before.cbegin();
+    auto new_dtc = after.cbegin();
+    while (old_dtc != before.cend() || new_dtc != after.cend())
+    {
+        if (new_dtc == after.cend() || (old_dtc != before.cend() && *old_dtc < *new_dtc))
+        {
+            cleared.push_back(*old_dtc++);
+        }
+        else if (old_dtc == before.cend() || *new_dtc < *old_dtc)
+        {
+            appeared.push_back(*new_dtc++);
+        }
+        else
+        {
+            old_dtc++;
+            new_dtc++;
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __OBD_H
+#define __OBD_H
+
+#include <cstdint>
+#include <vector>
+
+static const int ANY_ECU = -1;
+
+// ISO 15765-4 addressing
+//  normal 11-bit:  request 0x7df (functional), 0x7e0-0x7e7 (physical), response 0x7e8-0x7ef
+//  normal fixed 29-bit: request 0x18db33f1 (functional), 0x18da<ecu>f1 (physical), response 0x18daf1<ecu>
+// ECU numbers are the slot 0-7 for 11-bit and the source address 0x00-0xff for 29-bit
+class OBDAddressing
+{
+    public:
+        OBDAddressing(bool extended = false);
+
+        bool extended() const { return is_extended; }
+        int max_ecus() const;
+
+        uint32_t broadcast_id() const;
+        uint32_t request_id(int ecu) const;
+        uint32_t response_id(int ecu) const;
+        uint32_t response_mask() const; // matches the responses of every ECU
+
+        int ecu_of_response(uint32_t id) const; // ANY_ECU when not an ECU response
+        uint32_t request_for_response(uint32_t id) const;
+
+        bool is_broadcast(uint32_t id) const;
+        int ecu_of_request(uint32_t id) const; // ANY_ECU when not a physical request
+
+    private:
+        bool is_extended;
+};
+
+// Changes between two DTC sets, in a single pass over both
+void diff_dtcs(const std::vector<uint16_t> &before, const std::vector<uint16_t> &after,
+    std::vector<uint16_t> &appeared, std::vector<uint16_t> &cleared);
+
+#endif // __OBD_H
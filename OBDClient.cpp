@@ -0,0 +1,473 @@
+#include "OBDClient.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+
+// Supported PIDs of show data, 7 pages of 0x20; 0x01-0xe0
+using show_data_pages = supported_pid_pages<obd_service::show_data, std::tuple_size_v<obd_capabilities>>;
+using vehicle_info_supported = supported_pids<obd_service::vehicle_info, 0x00>;
+
+static uint32_t read_features(const obd_frame &buffer, show_data_pages::parser parse)
+{
+    if (buffer[1] == OBD_NEGATIVE_RESPONSE)
+    {
+        // Response id was unknown, therefore no features possible
+        Metrics::negative_response();
+        return 0;
+    }
+
+    return parse(single_frame_payload(buffer), single_frame_length(buffer));
+}
+
+OBDClient::OBDClient(CANDevice &can, const OBDAddressing &addressing)
+: can{ can }, obd{ addressing }
+{
+}
+
+void OBDClient::until_expire(const std::function<bool()> &what)
+{
+    const auto expire = std::chrono::steady_clock::now() + response_wait;
+    bool abort = false;
+    while (std::chrono::steady_clock::now() < expire && !abort)
+    {
+        abort = what();
+        if (idle_callback)
+        {
+            idle_callback();
+        }
+    }
+
+    if (!abort)
+    {
+        OBEY_TRACE_EVENT(trace_type::deadline_expired, 0, 0, static_cast<uint16_t>(std::min<int64_t>(response_wait.count(), 0xffff)), 0);
+    }
+}
+
+void OBDClient::acknowledge(ISO15765Decoder &decoder, uint32_t id)
+{
+    // stops after a WAIT frame, the next one is due wait_interval later
+    while (decoder.flow_control_due())
+    {
+        const obd_frame frame = decoder.flow_control_frame();
+        can.data_send(obd.request_for_response(id), frame);
+        OBEY_TRACE_EVENT(trace_type::flow_control_sent, id, frame[0] & 0x0f, frame[1], frame[2]);
+    }
+}
+
+void OBDClient::send(const obd_frame &frame, int ecu)
+{
+    if (pacer != nullptr)
+    {
+        pacer->acquire(obd.extended());
+    }
+
+    if (ecu < 0)
+    {
+        // Broadcast to all ECUs, accept the response of any
+        can.filter(obd.response_id(0), obd.response_mask());
+        can.data_send(obd.broadcast_id(), frame);
+    }
+    else
+    {
+        can.filter(obd.response_id(ecu));
+        can.data_send(obd.request_id(ecu), frame);
+    }
+}
+
+std::vector<uint8_t> OBDClient::receive(int service, int pid, int *responder)
+{
+    // sent right before
+    const auto requested = std::chrono::steady_clock::now();
+
+    ISO15765Decoder decoder{flow};
+    bool received = false;
+
+    uint32_t sender = 0;
+    bool locked = false;
+
+    obd_frame buffer{};
+
+    until_expire([&]() -> bool {
+        if (locked)
+        {
+            // WAIT frames and the clear to send after them
+            acknowledge(decoder, sender);
+        }
+
+        uint32_t id = 0;
+
+        if (!can.data_receive(id, buffer))
+        {
+            return false;
+        }
+
+        if (locked && id != sender)
+        {
+            // another ECU answering a broadcast, keep the first responder
+            return false;
+        }
+
+        sender = id;
+        received = true;
+
+        const bool more = decoder.add_fragment(buffer, id);
+
+        // acknowledge first frames and completed blocks before anything else
+        acknowledge(decoder, id);
+
+        if (more)
+        {
+            locked = true;
+
+            return false;
+        }
+
+        return true; // expire the loop
+    });
+
+    std::vector<uint8_t> data = decoder.get_data();
+
+    if (!received)
+    {
+        Metrics::timeout();
+    }
+    else
+    {
+        if (locked)
+        {
+            Metrics::reassembly(!data.empty());
+            Metrics::missed_frames(decoder.missed());
+
+#ifdef OBEY_TRACE
+            if (data.empty())
+            {
+                // keep the events leading to the failure
+                Trace::dump();
+            }
+#endif
+        }
+
+        if (!data.empty())
+        {
+            if (data[0] == OBD_NEGATIVE_RESPONSE)
+            {
+                Metrics::negative_response();
+            }
+
+            Metrics::latency(obd.ecu_of_response(sender), service, pid, std::chrono::steady_clock::now() - requested);
+        }
+    }
+
+    if (responder != nullptr)
+    {
+        *responder = received ? obd.ecu_of_response(sender) : ANY_ECU;
+    }
+
+    return data;
+}
+
+std::optional<obd_reply> OBDClient::positive(int ecu, int service, int pid, std::vector<uint8_t> data)
+{
+    if (data.empty() || data[0] != (service | OBD_RESPONSE_OFFSET))
+    {
+        return std::nullopt;
+    }
+
+    // service 0x02 adds the frame number and 0x09 the number of data items after the PID
+    const size_t offset = std::min<size_t>(RESPONSE_DATA_OFFSETS[service & 0x3f], data.size());
+    return obd_reply{ecu, service, pid, std::move(data), offset};
+}
+
+std::map<int, obd_capabilities> OBDClient::enumerate()
+{
+    // Accept the response of every ECU (0x7e8 - 0x7ef, or 0x18daf1xx)
+    const auto requested = std::chrono::steady_clock::now();
+    send(show_data_pages::frames[0], ANY_ECU);
+
+    // ECUs are discovered by their response id (source address with 29-bit)
+    std::map<int, obd_capabilities> ecus{};
+
+    // Wait for ECU responses
+    until_expire([&]() -> bool {
+        uint32_t can_id = 0;
+        obd_frame buffer{};
+
+        if (can.data_receive(can_id, buffer))
+        {
+            const int ecu = obd.ecu_of_response(can_id);
+            if (ecu != ANY_ECU)
+            {
+                Metrics::latency(ecu, obd_service::show_data, 0x00, std::chrono::steady_clock::now() - requested);
+                ecus[ecu][0] = read_features(buffer, show_data_pages::parsers[0]);
+            }
+        }
+
+        return false;
+    });
+
+    if (ecus.empty())
+    {
+        Metrics::timeout();
+        return ecus;
+    }
+
+    // Further pages of the ECUs that announce them
+    for (auto &[ecu, pages] : ecus)
+    {
+        for (size_t page = 1; page < pages.size() && (pages[page - 1] & 0x01); page++)
+        {
+            send(show_data_pages::frames[page], ecu);
+            until_expire([&]() -> bool {
+                uint32_t can_id = 0;
+                obd_frame buffer{};
+
+                if (can.data_receive(can_id, buffer))
+                {
+                    pages[page] = read_features(buffer, show_data_pages::parsers[page]);
+
+                    return true;
+                }
+
+                return false;
+            });
+        }
+    }
+
+    return ecus;
+}
+
+obd_capabilities OBDClient::supported_pids(int ecu)
+{
+    obd_capabilities pages{};
+    for (size_t page = 0; page < pages.size(); page++)
+    {
+        send(show_data_pages::frames[page], ecu);
+        const std::vector<uint8_t> data = receive(obd_service::show_data, page * show_data_pages::PAGE_SIZE);
+        pages[page] = show_data_pages::parsers[page](data.data(), data.size());
+
+        if (!(pages[page] & 0x01))
+        {
+            // no next page
+            break;
+        }
+    }
+
+    return pages;
+}
+
+std::optional<obd_supported> OBDClient::vehicle_info(int ecu)
+{
+    const auto requested = std::chrono::steady_clock::now();
+    send(vehicle_info_supported::request::frame, ecu);
+
+    std::optional<obd_supported> supported;
+    until_expire([&]() -> bool {
+        uint32_t id = 0;
+        obd_frame buffer{};
+
+        if (can.data_receive(id, buffer))
+        {
+            const int responder = obd.ecu_of_response(id);
+            Metrics::latency(responder, obd_service::vehicle_info, 0x00, std::chrono::steady_clock::now() - requested);
+
+            supported = obd_supported{responder, read_features(buffer, &vehicle_info_supported::parse)};
+
+            return true;
+        }
+        return false;
+    });
+
+    if (!supported)
+    {
+        Metrics::timeout();
+    }
+
+    return supported;
+}
+
+std::optional<std::string> OBDClient::vin(int ecu, int *responder)
+{
+    using vin = vehicle_information<0x02>;
+
+    send(vin::request::frame, ecu);
+    const std::vector<uint8_t> data = receive(obd_service::vehicle_info, 0x02, responder);
+    if (!vin::response::matches(data.data(), data.size()))
+    {
+        return std::nullopt;
+    }
+
+    // some ECUs pad the front
+    const uint8_t *begin = vin::response::data(data.data());
+    const uint8_t *end = data.data() + data.size();
+    return std::string(std::find_if(begin, end, [](uint8_t c) { return c > ' '; }), end);
+}
+
+std::optional<obd_reply> OBDClient::request(int service, int pid, int ecu)
+{
+    send(make_request_frame(service, pid), ecu);
+
+    int responder = ANY_ECU;
+    std::vector<uint8_t> data = receive(service, pid, &responder);
+
+    return positive(responder, service, pid, std::move(data));
+}
+
+std::optional<obd_value> OBDClient::read_pid(const pid_info &info, int ecu)
+{
+    send(*info.request, ecu);
+
+    int responder = ANY_ECU;
+    const std::vector<uint8_t> data = receive(obd_service::show_data, info.pid, &responder);
+
+    // service, PID, length and data offset of the descriptor behind info
+    double value = 0;
+    if (!info.parse(data.data(), data.size(), value))
+    {
+        return std::nullopt;
+    }
+
+    return obd_value{responder, &info, value};
+}
+
+void OBDClient::clear_dtc(int ecu)
+{
+    send(obd_request<obd_service::clear_dtcs>::frame, ecu);
+}
+
+std::map<int, std::vector<uint8_t>> OBDClient::broadcast(const obd_frame &frame, int service, size_t expected)
+{
+    send(frame, ANY_ECU);
+
+    const auto requested = std::chrono::steady_clock::now();
+
+    std::map<int, ISO15765Decoder> decoders;
+    std::map<int, std::vector<uint8_t>> responses;
+
+    until_expire([&]() -> bool {
+        for (auto &[ecu, decoder] : decoders)
+        {
+            acknowledge(decoder, obd.response_id(ecu));
+        }
+
+        uint32_t id = 0;
+        obd_frame buffer{};
+
+        if (!can.data_receive(id, buffer))
+        {
+            return false;
+        }
+
+        const int ecu = obd.ecu_of_response(id);
+        if (ecu == ANY_ECU || responses.count(ecu) > 0)
+        {
+            return false;
+        }
+
+        ISO15765Decoder &decoder = decoders.try_emplace(ecu, flow).first->second;
+        decoder.add_fragment(buffer, id);
+        acknowledge(decoder, id);
+
+        if (decoder.completed())
+        {
+            responses[ecu] = decoder.get_data();
+            Metrics::latency(ecu, service, 0x00, std::chrono::steady_clock::now() - requested);
+        }
+
+        return expected > 0 && responses.size() >= expected;
+    });
+
+    if (responses.empty())
+    {
+        Metrics::timeout();
+    }
+
+    return responses;
+}
+
+void OBDClient::request_overlapped(const std::vector<obd_query> &queries,
+    const std::function<void(size_t, const std::optional<obd_reply> &)> &done)
+{
+    struct exchange
+    {
+        ISO15765Decoder decoder;
+        bool received;
+        bool done;
+    };
+
+    std::vector<exchange> exchanges;
+    std::map<int, size_t> by_ecu;
+    for (const obd_query &query : queries)
+    {
+        by_ecu[query.ecu] = exchanges.size();
+        exchanges.push_back({ISO15765Decoder{flow}, false, false});
+    }
+
+    can.filter(obd.response_id(0), obd.response_mask());
+
+    const auto requested = std::chrono::steady_clock::now();
+    for (const obd_query &query : queries)
+    {
+        if (pacer != nullptr)
+        {
+            pacer->acquire(obd.extended());
+        }
+        can.data_send(obd.request_id(query.ecu), make_request_frame(query.service, query.pid));
+    }
+
+    size_t remaining = exchanges.size();
+    until_expire([&]() -> bool {
+        for (size_t index = 0; index < exchanges.size(); index++)
+        {
+            if (!exchanges[index].done)
+            {
+                acknowledge(exchanges[index].decoder, obd.response_id(queries[index].ecu));
+            }
+        }
+
+        uint32_t id = 0;
+        obd_frame buffer{};
+
+        if (!can.data_receive(id, buffer))
+        {
+            return false;
+        }
+
+        const auto found = by_ecu.find(obd.ecu_of_response(id));
+        if (found == by_ecu.end() || exchanges[found->second].done)
+        {
+            return false;
+        }
+
+        const size_t index = found->second;
+        exchange &each = exchanges[index];
+        each.received = true;
+        each.decoder.add_fragment(buffer, id);
+        acknowledge(each.decoder, id);
+
+        if (each.decoder.completed())
+        {
+            each.done = true;
+            remaining--;
+
+            const obd_query &query = queries[index];
+            Metrics::latency(query.ecu, query.service, query.pid, std::chrono::steady_clock::now() - requested);
+            done(index, positive(query.ecu, query.service, query.pid, each.decoder.get_data()));
+        }
+
+        return remaining == 0;
+    });
+
+    for (size_t index = 0; index < exchanges.size(); index++)
+    {
+        if (!exchanges[index].received)
+        {
+            Metrics::timeout();
+        }
+
+        if (!exchanges[index].done)
+        {
+            done(index, std::nullopt);
+        }
+    }
+}
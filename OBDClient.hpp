@@ -0,0 +1,144 @@
+#ifndef __OBD_CLIENT_H
+#define __OBD_CLIENT_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "BusLoad.hpp"
+#include "CAN.hpp"
+#include "DTC.hpp"
+#include "ISO15765.hpp"
+#include "OBD.hpp"
+#include "OBDDescriptor.hpp"
+#include "PID.hpp"
+
+// Supported show data PIDs, pages 0x01-0x20 ... 0xc1-0xe0
+using obd_capabilities = std::array<uint32_t, 7>;
+
+// Positive response of an ECU
+struct obd_reply
+{
+    int ecu; // responder
+    int service;
+    int pid;
+    std::vector<uint8_t> data; // whole response, service | 0x40 first
+    size_t offset; // of the PID data in data
+};
+
+struct obd_value
+{
+    int ecu;
+    const pid_info *info;
+    double value;
+};
+
+struct obd_dtcs
+{
+    int ecu;
+    std::span<const dtc_entry> dtcs; // in the decoder's buffer, valid until its next decode
+};
+
+struct obd_supported
+{
+    int ecu;
+    uint32_t supported; // bit 31 = PID 0x01
+};
+
+struct obd_query
+{
+    int ecu;
+    int service;
+    int pid;
+};
+
+// OBD-II requests over one CAN device, results returned as values, nothing printed
+// ecu is ANY_ECU to broadcast and take the first responder
+class OBDClient
+{
+    public:
+        OBDClient(CANDevice &can, const OBDAddressing &addressing);
+
+        // response timeout, default 1s
+        void wait(std::chrono::milliseconds timeout) { response_wait = timeout; }
+        std::chrono::milliseconds wait() const { return response_wait; }
+
+        void flow_control(const ISO15765FlowControl &parameters) { flow = parameters; }
+
+        // requests wait for this pacer, none when null
+        void pacing(BusPacer *limiter) { pacer = limiter; }
+
+        // called while waiting for responses
+        void idle(std::function<void()> callback) { idle_callback = std::move(callback); }
+
+        const OBDAddressing &addressing() const { return obd; }
+
+        // supported show data PIDs of every ECU answering a broadcast
+        std::map<int, obd_capabilities> enumerate();
+
+        // supported show data PIDs of one ECU, until a page does not announce the next
+        obd_capabilities supported_pids(int ecu);
+
+        // supported vehicle information (0x09)
+        std::optional<obd_supported> vehicle_info(int ecu = ANY_ECU);
+
+        // responder: the ECU that answered
+        std::optional<std::string> vin(int ecu = ANY_ECU, int *responder = nullptr);
+
+        std::optional<obd_reply> request(int service, int pid, int ecu = ANY_ECU);
+        std::optional<obd_value> read_pid(const pid_info &info, int ecu = ANY_ECU);
+
+        // the payload decoded straight into decoder, with the status implied by Source
+        template <obd_service Source>
+        std::optional<obd_dtcs> read_dtc(DTCDecoder &decoder, int ecu = ANY_ECU)
+        {
+            using dtcs = dtc_list<Source>;
+
+            send(dtcs::request::frame, ecu);
+
+            int responder = ANY_ECU;
+            const std::vector<uint8_t> data = receive(Source, 0x00, &responder);
+            if (!dtcs::response::matches(data.data(), data.size()))
+            {
+                return std::nullopt;
+            }
+
+            return obd_dtcs{responder, decoder.decode(data, dtc_status(Source))};
+        }
+
+        void clear_dtc(int ecu = ANY_ECU);
+
+        // One broadcast, the response of every ECU reassembled separately, negative ones included
+        // Stops early once expected (> 0) ECUs completed
+        std::map<int, std::vector<uint8_t>> broadcast(const obd_frame &frame, int service, size_t expected = 0);
+
+        // Requests to distinct ECUs in flight together; done(index, reply) as each completes,
+        // then with no reply for the rest once the wait expired
+        void request_overlapped(const std::vector<obd_query> &queries,
+            const std::function<void(size_t, const std::optional<obd_reply> &)> &done);
+
+        // ISO 15765 request and reassembled response of one ECU
+        void send(const obd_frame &frame, int ecu);
+        std::vector<uint8_t> receive(int service, int pid, int *responder = nullptr);
+
+    private:
+        void until_expire(const std::function<bool()> &what);
+        void acknowledge(ISO15765Decoder &decoder, uint32_t id); // due flow control frames to the sender of id
+        static std::optional<obd_reply> positive(int ecu, int service, int pid, std::vector<uint8_t> data);
+
+        CANDevice &can;
+        const OBDAddressing obd;
+
+        std::chrono::milliseconds response_wait{1000};
+        ISO15765FlowControl flow{};
+        BusPacer *pacer{};
+        std::function<void()> idle_callback;
+};
+
+#endif // __OBD_CLIENT_H
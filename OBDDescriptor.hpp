@@ -0,0 +1,224 @@
+#ifndef __OBD_DESCRIPTOR_H
+#define __OBD_DESCRIPTOR_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Compile-time descriptors of OBD-II requests and responses.
+// A request type carries its CAN frame as a constant, a response type the
+// position and size of its payload, so parsing needs no runtime service checks.
+
+using obd_frame = std::array<uint8_t, 8>;
+
+static const uint8_t OBD_PAD_BYTE = 0xCC;
+static const uint8_t OBD_RESPONSE_OFFSET = 0x40; // positive response = service | 0x40
+static const uint8_t OBD_NEGATIVE_RESPONSE = 0x7f;
+static const int NO_PID = -1;
+static const int MAX_STANDARD_PID = 0xff;
+
+enum obd_service:uint8_t
+{
+    show_data = 0x01,
+    freeze_frame = 0x02,
+    stored_dtc = 0x03,
+    clear_dtcs = 0x04,
+    pending_dtc = 0x07,
+    vehicle_info = 0x09,
+    permanent_dtc = 0x0a
+};
+
+// ISO-15765 single frame: length, service, PID (1 or 2 bytes), padding
+constexpr obd_frame make_request_frame(int service, int pid = NO_PID)
+{
+    obd_frame frame{};
+    for (auto &each : frame)
+    {
+        each = OBD_PAD_BYTE;
+    }
+
+    frame[1] = static_cast<uint8_t>(service);
+    if (pid > MAX_STANDARD_PID)
+    {
+        frame[2] = static_cast<uint8_t>(pid >> 8);
+        frame[3] = static_cast<uint8_t>(pid);
+        frame[0] = 3;
+    }
+    else if (pid >= 0)
+    {
+        frame[2] = static_cast<uint8_t>(pid);
+        frame[0] = 2;
+    }
+    else
+    {
+        frame[0] = 1;
+    }
+
+    return frame;
+}
+
+// Offset of the data in a reassembled positive response, per service
+constexpr size_t response_data_offset(int service)
+{
+    switch (service)
+    {
+    case obd_service::freeze_frame: // service, PID, frame number
+    case obd_service::vehicle_info: // service, PID, number of data items
+        return 3;
+    case obd_service::stored_dtc:
+    case obd_service::clear_dtcs:
+    case obd_service::pending_dtc:
+    case obd_service::permanent_dtc:
+        return 1;
+    default: // service, PID
+        return 2;
+    }
+}
+
+// Indexed by service, for services only known at runtime
+static constexpr std::array<uint8_t, 0x40> RESPONSE_DATA_OFFSETS = []() {
+    std::array<uint8_t, 0x40> offsets{};
+    for (size_t service = 0; service < offsets.size(); service++)
+    {
+        offsets[service] = response_data_offset(service);
+    }
+    return offsets;
+}();
+
+template <uint8_t Service, int Pid = NO_PID>
+struct obd_request
+{
+    static constexpr uint8_t service = Service;
+    static constexpr int pid = Pid;
+    static constexpr obd_frame frame = make_request_frame(Service, Pid);
+};
+
+// Length 0 for variable length data
+template <uint8_t Service, int Pid, size_t Length, size_t Offset = response_data_offset(Service)>
+struct obd_response
+{
+    static constexpr uint8_t positive = Service | OBD_RESPONSE_OFFSET;
+    static constexpr size_t offset = Offset;
+    static constexpr size_t length = Length;
+
+    // a positive response to this request, long enough for the data
+    static constexpr bool matches(const uint8_t *response, size_t size)
+    {
+        if constexpr (Pid >= 0 && Pid <= MAX_STANDARD_PID)
+        {
+            return size >= offset + Length && response[0] == positive && response[1] == Pid;
+        }
+        else
+        {
+            return size >= offset + Length && response[0] == positive;
+        }
+    }
+
+    static constexpr const uint8_t *data(const uint8_t *response)
+    {
+        return response + offset;
+    }
+};
+
+// Big endian unsigned of N bytes, unrolled at compile time
+template <size_t N>
+constexpr uint32_t read_unsigned(const uint8_t *data)
+{
+    return [&]<size_t... I>(std::index_sequence<I...>) {
+        return ((static_cast<uint32_t>(data[I]) << (8 * (N - 1 - I))) | ... | 0u);
+    }(std::make_index_sequence<N>{});
+}
+
+// Supported PIDs bitmap, PID 0x00, 0x20, 0x40 ... of a service, always right after the PID
+template <uint8_t Service, int Pid>
+struct supported_pids
+{
+    using request = obd_request<Service, Pid>;
+    using response = obd_response<Service, Pid, 4, 2>;
+
+    // 0 when not a positive response, no PIDs supported
+    static constexpr uint32_t parse(const uint8_t *payload, size_t size)
+    {
+        return response::matches(payload, size) ? read_unsigned<4>(response::data(payload)) : 0;
+    }
+};
+
+// Supported PID pages 0x00, 0x20 ... of a service, indexed by page at runtime
+template <uint8_t Service, size_t Pages>
+struct supported_pid_pages
+{
+    static constexpr int PAGE_SIZE = 0x20;
+    using parser = uint32_t (*)(const uint8_t *payload, size_t size);
+
+    static constexpr std::array<obd_frame, Pages> frames = []<size_t... Page>(std::index_sequence<Page...>) {
+        return std::array<obd_frame, Pages>{ supported_pids<Service, Page * PAGE_SIZE>::request::frame... };
+    }(std::make_index_sequence<Pages>{});
+
+    static constexpr std::array<parser, Pages> parsers = []<size_t... Page>(std::index_sequence<Page...>) {
+        return std::array<parser, Pages>{ &supported_pids<Service, Page * PAGE_SIZE>::parse... };
+    }(std::make_index_sequence<Pages>{});
+};
+
+// Payload of an ISO-15765 single frame
+constexpr const uint8_t *single_frame_payload(const obd_frame &frame)
+{
+    return frame.data() + 1;
+}
+
+constexpr size_t single_frame_length(const obd_frame &frame)
+{
+    return std::min<size_t>(frame[0] & 0x0f, frame.size() - 1);
+}
+
+// Scalar PID of show data (0x01): value = (big endian data bytes) * Scale + Offset
+// The data layout is the same in freeze frames (0x02), after the frame number
+template <uint8_t Pid, size_t Length, double Scale, double Offset>
+struct scalar_pid
+{
+    static constexpr uint8_t pid = Pid;
+    static constexpr size_t length = Length;
+
+    using request = obd_request<obd_service::show_data, Pid>;
+    using response = obd_response<obd_service::show_data, Pid, Length>;
+
+    // data: the value bytes
+    static constexpr double decode(const uint8_t *data)
+    {
+        return read_unsigned<Length>(data) * Scale + Offset;
+    }
+
+    // false when not a positive response for this PID
+    static constexpr bool parse(const uint8_t *payload, size_t size, double &value)
+    {
+        if (!response::matches(payload, size))
+        {
+            return false;
+        }
+
+        value = decode(response::data(payload));
+        return true;
+    }
+};
+
+// DTC list of stored (0x03), pending (0x07) or permanent (0x0a) codes
+template <obd_service Service>
+struct dtc_list
+{
+    static_assert(Service == obd_service::stored_dtc || Service == obd_service::pending_dtc ||
+        Service == obd_service::permanent_dtc);
+
+    using request = obd_request<Service>;
+    using response = obd_response<Service, NO_PID, 0>;
+};
+
+// Vehicle information (0x09) item, data follows the number of data items
+template <int Pid>
+struct vehicle_information
+{
+    using request = obd_request<obd_service::vehicle_info, Pid>;
+    using response = obd_response<obd_service::vehicle_info, Pid, 0>;
+};
+
+#endif // __OBD_DESCRIPTOR_H
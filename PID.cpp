@@ -0,0 +1,39 @@
+#include "PID.hpp"
+
+#include <algorithm>
+#include <array>
+
+template <typename... Descriptor>
+constexpr std::array<pid_info, sizeof...(Descriptor)> make_pid_table()
+{
+    return {{ {Descriptor::pid, Descriptor::length, Descriptor::name, Descriptor::unit, &Descriptor::decode, &Descriptor::parse, &Descriptor::request::frame}... }};
+}
+
+// sorted by pid
+static constexpr auto PIDS = make_pid_table<
+    engine_load, coolant_temperature,
+    short_fuel_trim_1, long_fuel_trim_1, short_fuel_trim_2, long_fuel_trim_2,
+    fuel_pressure, intake_pressure, engine_speed, vehicle_speed, timing_advance,
+    intake_temperature, maf_rate, throttle_position, run_time, distance_mil_on,
+    fuel_rail_pressure, fuel_rail_gauge_pressure, fuel_level, distance_since_clear,
+    barometric_pressure, module_voltage, relative_throttle, ambient_temperature,
+    accelerator_position, time_mil_on, oil_temperature, fuel_rate
+>();
+
+static_assert(std::is_sorted(PIDS.cbegin(), PIDS.cend(), [](const pid_info &a, const pid_info &b) {
+    return a.pid < b.pid;
+}));
+
+const pid_info *find_pid(int pid)
+{
+    const auto found = std::lower_bound(PIDS.cbegin(), PIDS.cend(), pid, [](const pid_info &info, int pid) {
+        return info.pid < pid;
+    });
+
+    return (found != PIDS.cend() && found->pid == pid) ? &*found : nullptr;
+}
+
+double decode_pid(const pid_info &info, const uint8_t *data)
+{
+    return info.decode(data);
+}
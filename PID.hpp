@@ -0,0 +1,54 @@
+#ifndef __PID_H
+#define __PID_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "OBDDescriptor.hpp"
+
+// Scaled values of show data (0x01) and freeze frame (0x02) PIDs, SAE J1979
+struct engine_load : scalar_pid<0x04, 1, 100.0 / 255, 0.0> { static constexpr const char *name = "Engine load", *unit = "%"; };
+struct coolant_temperature : scalar_pid<0x05, 1, 1.0, -40.0> { static constexpr const char *name = "Coolant temperature", *unit = "C"; };
+struct short_fuel_trim_1 : scalar_pid<0x06, 1, 100.0 / 128, -100.0> { static constexpr const char *name = "Short term fuel trim bank 1", *unit = "%"; };
+struct long_fuel_trim_1 : scalar_pid<0x07, 1, 100.0 / 128, -100.0> { static constexpr const char *name = "Long term fuel trim bank 1", *unit = "%"; };
+struct short_fuel_trim_2 : scalar_pid<0x08, 1, 100.0 / 128, -100.0> { static constexpr const char *name = "Short term fuel trim bank 2", *unit = "%"; };
+struct long_fuel_trim_2 : scalar_pid<0x09, 1, 100.0 / 128, -100.0> { static constexpr const char *name = "Long term fuel trim bank 2", *unit = "%"; };
+struct fuel_pressure : scalar_pid<0x0a, 1, 3.0, 0.0> { static constexpr const char *name = "Fuel pressure", *unit = "kPa"; };
+struct intake_pressure : scalar_pid<0x0b, 1, 1.0, 0.0> { static constexpr const char *name = "Intake manifold pressure", *unit = "kPa"; };
+struct engine_speed : scalar_pid<0x0c, 2, 0.25, 0.0> { static constexpr const char *name = "Engine speed", *unit = "rpm"; };
+struct vehicle_speed : scalar_pid<0x0d, 1, 1.0, 0.0> { static constexpr const char *name = "Vehicle speed", *unit = "km/h"; };
+struct timing_advance : scalar_pid<0x0e, 1, 0.5, -64.0> { static constexpr const char *name = "Timing advance", *unit = "deg"; };
+struct intake_temperature : scalar_pid<0x0f, 1, 1.0, -40.0> { static constexpr const char *name = "Intake air temperature", *unit = "C"; };
+struct maf_rate : scalar_pid<0x10, 2, 0.01, 0.0> { static constexpr const char *name = "MAF air flow rate", *unit = "g/s"; };
+struct throttle_position : scalar_pid<0x11, 1, 100.0 / 255, 0.0> { static constexpr const char *name = "Throttle position", *unit = "%"; };
+struct run_time : scalar_pid<0x1f, 2, 1.0, 0.0> { static constexpr const char *name = "Run time since engine start", *unit = "s"; };
+struct distance_mil_on : scalar_pid<0x21, 2, 1.0, 0.0> { static constexpr const char *name = "Distance with MIL on", *unit = "km"; };
+struct fuel_rail_pressure : scalar_pid<0x22, 2, 0.079, 0.0> { static constexpr const char *name = "Fuel rail pressure", *unit = "kPa"; };
+struct fuel_rail_gauge_pressure : scalar_pid<0x23, 2, 10.0, 0.0> { static constexpr const char *name = "Fuel rail gauge pressure", *unit = "kPa"; };
+struct fuel_level : scalar_pid<0x2f, 1, 100.0 / 255, 0.0> { static constexpr const char *name = "Fuel tank level", *unit = "%"; };
+struct distance_since_clear : scalar_pid<0x31, 2, 1.0, 0.0> { static constexpr const char *name = "Distance since codes cleared", *unit = "km"; };
+struct barometric_pressure : scalar_pid<0x33, 1, 1.0, 0.0> { static constexpr const char *name = "Barometric pressure", *unit = "kPa"; };
+struct module_voltage : scalar_pid<0x42, 2, 0.001, 0.0> { static constexpr const char *name = "Control module voltage", *unit = "V"; };
+struct relative_throttle : scalar_pid<0x45, 1, 100.0 / 255, 0.0> { static constexpr const char *name = "Relative throttle position", *unit = "%"; };
+struct ambient_temperature : scalar_pid<0x46, 1, 1.0, -40.0> { static constexpr const char *name = "Ambient air temperature", *unit = "C"; };
+struct accelerator_position : scalar_pid<0x49, 1, 100.0 / 255, 0.0> { static constexpr const char *name = "Accelerator pedal position D", *unit = "%"; };
+struct time_mil_on : scalar_pid<0x4d, 2, 1.0, 0.0> { static constexpr const char *name = "Time run with MIL on", *unit = "min"; };
+struct oil_temperature : scalar_pid<0x5c, 1, 1.0, -40.0> { static constexpr const char *name = "Engine oil temperature", *unit = "C"; };
+struct fuel_rate : scalar_pid<0x5e, 2, 0.05, 0.0> { static constexpr const char *name = "Engine fuel rate", *unit = "L/h"; };
+
+// Runtime view of a descriptor, for PIDs chosen at runtime
+struct pid_info
+{
+    uint8_t pid;
+    uint8_t length; // data bytes
+    const char *name;
+    const char *unit;
+    double (*decode)(const uint8_t *data);
+    bool (*parse)(const uint8_t *payload, size_t size, double &value); // whole response, checked by the descriptor
+    const obd_frame *request;
+};
+
+const pid_info *find_pid(int pid); // nullptr when not a known scalar PID
+double decode_pid(const pid_info &info, const uint8_t *data);
+
+#endif // __PID_H
@@ -0,0 +1,88 @@
+#ifndef __SPSC_QUEUE_H
+#define __SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Lock-free bounded queue for exactly one producer thread and one consumer thread
+template <typename T>
+class SPSCQueue
+{
+    public:
+        // capacity is rounded up to a power of two
+        SPSCQueue(size_t capacity)
+        : mask{ round_up(capacity) - 1 }, slots{ std::make_unique<T[]>(mask + 1) }
+        {
+        }
+
+        // producer
+        bool push(const T &item)
+        {
+            const size_t tail = tail_index.load(std::memory_order_relaxed);
+            if (tail - head_cache == mask + 1)
+            {
+                head_cache = head_index.load(std::memory_order_acquire);
+                if (tail - head_cache == mask + 1)
+                {
+                    return false; // full
+                }
+            }
+
+            slots[tail & mask] = item;
+            tail_index.store(tail + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // consumer
+        bool pop(T &item)
+        {
+            const size_t head = head_index.load(std::memory_order_relaxed);
+            if (head == tail_cache)
+            {
+                tail_cache = tail_index.load(std::memory_order_acquire);
+                if (head == tail_cache)
+                {
+                    return false; // empty
+                }
+            }
+
+            item = slots[head & mask];
+            head_index.store(head + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // approximate when called concurrently
+        size_t size() const
+        {
+            return tail_index.load(std::memory_order_acquire) - head_index.load(std::memory_order_acquire);
+        }
+
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        static size_t round_up(size_t n)
+        {
+            size_t size = 1;
+            while (size < n)
+            {
+                size <<= 1;
+            }
+            return size;
+        }
+
+        static const size_t LINE = 64;
+
+        const size_t mask;
+        const std::unique_ptr<T[]> slots;
+
+        // producer and consumer indices on separate cache lines
+        alignas(LINE) std::atomic<size_t> tail_index{};
+        size_t head_cache{}; // producer copy of head_index
+        alignas(LINE) std::atomic<size_t> head_index{};
+        size_t tail_cache{}; // consumer copy of tail_index
+};
+
+#endif // __SPSC_QUEUE_H
@@ -0,0 +1,84 @@
+#include "SharedValues.hpp"
+
+#include <new>
+
+SharedValueTable::SharedValueTable(const std::string &name)
+: name{ name }
+{
+    // one writer per table, a second one would interleave its slots with ours
+    const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        const int error = errno;
+        throw std::system_error(error, std::system_category(), (error == EEXIST) ?
+            "Shared values open, " + name + " is in use or left by a crashed run (remove /dev/shm" + name + ")" :
+            std::string("Shared values open"));
+    }
+
+    if (::ftruncate(fd, sizeof(shared_value_table)) < 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::system_category(), "Shared values size");
+    }
+
+    void *mapping = ::mmap(nullptr, sizeof(shared_value_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::system_error(error, std::system_category(), "Shared values map");
+    }
+
+    table = new (mapping) shared_value_table{};
+    table->capacity = SHARED_VALUE_SLOTS;
+
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(table->magic, SHARED_VALUES_MAGIC, sizeof(SHARED_VALUES_MAGIC));
+}
+
+SharedValueTable::~SharedValueTable()
+{
+    ::munmap(table, sizeof(shared_value_table));
+    ::shm_unlink(name.c_str());
+}
+
+void SharedValueTable::publish(int ecu, int service, int pid, double value, int64_t time)
+{
+    const uint64_t key = static_cast<uint64_t>(ecu + 1) << 32 | static_cast<uint64_t>(service & 0xff) << 16 | (pid & 0xffff);
+
+    auto found = slots.find(key);
+    if (found == slots.end())
+    {
+        const uint32_t index = table->count.load(std::memory_order_relaxed);
+        if (index >= SHARED_VALUE_SLOTS)
+        {
+            // full, the channel is not published
+            return;
+        }
+
+        shared_value_slot &slot = table->slots[index];
+        slot.ecu = static_cast<int16_t>(ecu);
+        slot.service = static_cast<uint8_t>(service);
+        slot.pid = static_cast<uint16_t>(pid);
+
+        found = slots.emplace(key, index).first;
+        table->count.store(index + 1, std::memory_order_release);
+    }
+
+    shared_value_slot &slot = table->slots[found->second];
+
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // odd while writing
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.value.store(bits, std::memory_order_relaxed);
+    slot.time.store(time, std::memory_order_relaxed);
+    slot.updates.store(slot.updates.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,171 @@
+#ifndef __SHARED_VALUES_H
+#define __SHARED_VALUES_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Latest decoded value per (ECU, service, PID) in POSIX shared memory
+// One writer (obey poll -S <name>), any number of local readers.
+// Each slot is a seqlock: the sequence is odd while the writer updates it,
+// readers retry until they saw the same even sequence before and after copying.
+// Readers need nothing but this header, no syscalls after the mapping.
+
+static const char SHARED_VALUES_MAGIC[8] = {'O', 'B', 'E', 'Y', 'S', 'H', 'M', '1'};
+static const uint32_t SHARED_VALUE_SLOTS = 1024;
+
+struct alignas(64) shared_value_slot
+{
+    std::atomic<uint32_t> sequence;
+    // key, written once before the slot is counted
+    int16_t ecu; // -1 when unknown
+    uint8_t service;
+    uint8_t reserved;
+    uint16_t pid;
+    // value and time, under the sequence
+    std::atomic<uint64_t> value; // bits of a double
+    std::atomic<int64_t> time; // steady clock (CLOCK_MONOTONIC) nanoseconds
+    std::atomic<uint64_t> updates;
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+struct shared_value_table
+{
+    char magic[8]; // written last by the writer
+    uint32_t capacity;
+    std::atomic<uint32_t> count; // slots in use
+    shared_value_slot slots[SHARED_VALUE_SLOTS];
+};
+
+struct shared_value
+{
+    int ecu;
+    int service;
+    int pid;
+    double value;
+    int64_t time; // steady clock nanoseconds
+    uint64_t updates;
+};
+
+// Writer side, in obey
+class SharedValueTable
+{
+    public:
+        // name as for shm_open, e.g. /obey; fails when the table exists, removed again on destruction
+        SharedValueTable(const std::string &name);
+        ~SharedValueTable();
+
+        void publish(int ecu, int service, int pid, double value, int64_t time);
+
+    private:
+        const std::string name;
+        shared_value_table *table;
+        std::unordered_map<uint64_t, uint32_t> slots; // key to slot
+};
+
+// Reader side, header only
+class SharedValueReader
+{
+    public:
+        SharedValueReader(const std::string &name)
+        {
+            const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+            {
+                throw std::system_error(errno, std::system_category(), "Shared values open");
+            }
+
+            // the writer sizes the object after creating it, reading past its end raises SIGBUS
+            struct stat status{};
+            if (::fstat(fd, &status) < 0)
+            {
+                const int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::system_category(), "Shared values size");
+            }
+            if (status.st_size < static_cast<off_t>(sizeof(shared_value_table)))
+            {
+                ::close(fd);
+                throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "Shared values not sized yet");
+            }
+
+            void *mapping = ::mmap(nullptr, sizeof(shared_value_table), PROT_READ, MAP_SHARED, fd, 0);
+            const int error = errno;
+            ::close(fd);
+            if (mapping == MAP_FAILED)
+            {
+                throw std::system_error(error, std::system_category(), "Shared values map");
+            }
+
+            table = static_cast<const shared_value_table *>(mapping);
+            if (std::memcmp(table->magic, SHARED_VALUES_MAGIC, sizeof(SHARED_VALUES_MAGIC)) != 0)
+            {
+                ::munmap(mapping, sizeof(shared_value_table));
+                throw std::system_error(std::make_error_code(std::errc::invalid_argument), "Not an obey value table");
+            }
+        }
+
+        ~SharedValueReader()
+        {
+            ::munmap(const_cast<shared_value_table *>(table), sizeof(shared_value_table));
+        }
+
+        SharedValueReader(const SharedValueReader &) = delete;
+        SharedValueReader &operator=(const SharedValueReader &) = delete;
+
+        uint32_t count() const
+        {
+            return table->count.load(std::memory_order_acquire);
+        }
+
+        // slot of a channel, -1 until the writer published it once; look up once, read often
+        int find(int ecu, int service, int pid) const
+        {
+            const uint32_t used = count();
+            for (uint32_t i = 0; i < used; i++)
+            {
+                const shared_value_slot &slot = table->slots[i];
+                if (slot.ecu == ecu && slot.service == service && slot.pid == pid)
+                {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // consistent copy of a slot, lock free
+        shared_value read(int index) const
+        {
+            const shared_value_slot &slot = table->slots[index];
+            shared_value copy{slot.ecu, slot.service, slot.pid, 0, 0, 0};
+
+            uint32_t before = 0;
+            uint32_t after = 0;
+            uint64_t bits = 0;
+            do
+            {
+                before = slot.sequence.load(std::memory_order_acquire);
+                bits = slot.value.load(std::memory_order_relaxed);
+                copy.time = slot.time.load(std::memory_order_relaxed);
+                copy.updates = slot.updates.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = slot.sequence.load(std::memory_order_relaxed);
+            } while ((before & 1) || before != after);
+
+            std::memcpy(&copy.value, &bits, sizeof(copy.value));
+            return copy;
+        }
+
+    private:
+        const shared_value_table *table;
+};
+
+#endif // __SHARED_VALUES_H
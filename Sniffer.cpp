@@ -0,0 +1,175 @@
+#include "Sniffer.hpp"
+#include "OBDDescriptor.hpp"
+#include "PID.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+// services followed by a PID byte
+static bool has_pid(int service)
+{
+    return service == 0x01 || service == 0x02 || service == 0x05 || service == 0x06 ||
+        service == 0x08 || service == 0x09;
+}
+
+static bool is_dtc_service(int service)
+{
+    return service == 0x03 || service == 0x07 || service == 0x0a;
+}
+
+OBDSniffer::OBDSniffer(std::chrono::milliseconds expiry)
+: expiry{ expiry }, origin{ std::chrono::steady_clock::now() }
+{
+}
+
+const std::vector<can_filter> OBDSniffer::filters()
+{
+    const uint32_t match_sff = CAN_SFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+    const uint32_t match_eff = CAN_EFF_MASK | CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+    return {
+        {0x7df, match_sff},
+        {0x7e0, match_sff & ~0x0f}, // 0x7e0-0x7ef
+        {0x18db33f1 | CAN_EFF_FLAG, match_eff},
+        {0x18da00f1 | CAN_EFF_FLAG, match_eff & ~0xff00}, // requests 0x18daxxf1
+        {0x18daf100 | CAN_EFF_FLAG, match_eff & ~0xff}, // responses 0x18daf1xx
+    };
+}
+
+void OBDSniffer::frame(const can_rx_frame &frame)
+{
+    const OBDAddressing &addressing = (frame.id & CAN_EFF_FLAG) ? extended : normal;
+
+    const bool is_request = addressing.is_broadcast(frame.id) || addressing.ecu_of_request(frame.id) != ANY_ECU;
+    if (!is_request && addressing.ecu_of_response(frame.id) == ANY_ECU)
+    {
+        return;
+    }
+
+    // flow control frames belong to the opposite direction, the decoder ignores them
+    ISO15765Decoder &decoder = decoders[frame.id];
+    decoder.add_fragment(frame.data, frame.id);
+    if (!decoder.completed())
+    {
+        return;
+    }
+
+    const std::vector<uint8_t> payload = decoder.get_data();
+    if (payload.empty())
+    {
+        return;
+    }
+
+    // forget requests nobody answered
+    std::erase_if(pending, [&](const pending_request &each) {
+        return frame.received - each.sent > expiry;
+    });
+
+    if (is_request)
+    {
+        request(frame, addressing, payload);
+    }
+    else
+    {
+        response(frame, addressing, payload);
+    }
+}
+
+void OBDSniffer::timestamp(const can_rx_frame &frame) const
+{
+    printf("%12.6f ", std::chrono::duration<double>(frame.received - origin).count());
+}
+
+void OBDSniffer::request(const can_rx_frame &frame, const OBDAddressing &addressing, const std::vector<uint8_t> &payload)
+{
+    const int service = payload[0];
+    const int pid = (has_pid(service) && payload.size() > 1) ? payload[1] : -1;
+    const int ecu = addressing.ecu_of_request(frame.id);
+
+    pending.push_back({addressing.extended(), ecu, service, pid, frame.received});
+
+    timestamp(frame);
+    printf("REQ 0x%x ", frame.id & CAN_EFF_MASK);
+    if (ecu == ANY_ECU)
+    {
+        printf("ALL ");
+    }
+    else
+    {
+        printf("ECU %d ", ecu);
+    }
+    printf("service=%02x", service);
+    if (pid >= 0)
+    {
+        printf(" pid=%02x", pid);
+    }
+    printf("\n");
+}
+
+void OBDSniffer::response(const can_rx_frame &frame, const OBDAddressing &addressing, const std::vector<uint8_t> &payload)
+{
+    const int ecu = addressing.ecu_of_response(frame.id);
+    const bool negative = (payload[0] == OBD_NEGATIVE_RESPONSE);
+
+    const int service = negative ? ((payload.size() > 1) ? payload[1] : -1) : (payload[0] & ~OBD_RESPONSE_OFFSET);
+    const int pid = (!negative && has_pid(service) && payload.size() > 1) ? payload[1] : -1;
+
+    timestamp(frame);
+    printf("RSP 0x%x ECU %d service=%02x", frame.id & CAN_EFF_MASK, ecu, service);
+    if (pid >= 0)
+    {
+        printf(" pid=%02x", pid);
+    }
+
+    // oldest matching request, broadcasts stay pending for the other ECUs
+    const auto match = std::find_if(pending.begin(), pending.end(), [&](const pending_request &each) {
+        return each.extended == addressing.extended() && each.service == service &&
+            (pid < 0 || each.pid == pid) && (each.ecu == ANY_ECU || each.ecu == ecu);
+    });
+    if (match != pending.end())
+    {
+        printf(" [%.3f ms]", std::chrono::duration<double, std::milli>(frame.received - match->sent).count());
+        if (match->ecu != ANY_ECU)
+        {
+            pending.erase(match);
+        }
+    }
+    else
+    {
+        printf(" [unsolicited]");
+    }
+
+    if (negative)
+    {
+        printf(" negative nrc=%02x\n", (payload.size() > 2) ? payload[2] : 0);
+        return;
+    }
+
+    if (is_dtc_service(service))
+    {
+        printf(" DTC:");
+        for (const dtc_entry &dtc : dtc_decoder.decode(payload, dtc_status(service)))
+        {
+            printf(" %s", dtc.text);
+        }
+        printf("\n");
+        return;
+    }
+
+    // service 0x02 adds the frame number, service 0x09 the item count
+    const size_t offset = (service < static_cast<int>(RESPONSE_DATA_OFFSETS.size())) ? RESPONSE_DATA_OFFSETS[service] : 2;
+
+    const pid_info *info = (service == 0x01 || service == 0x02) ? find_pid(pid) : nullptr;
+    if (info != nullptr && payload.size() >= offset + info->length)
+    {
+        printf(" %s = %g %s\n", info->name, decode_pid(*info, payload.data() + offset), info->unit);
+        return;
+    }
+
+    printf(" data=");
+    for (size_t i = std::min(offset, payload.size()); i < payload.size(); i++)
+    {
+        printf("%02x", payload[i]);
+    }
+    printf("\n");
+}
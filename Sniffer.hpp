@@ -0,0 +1,52 @@
+#ifndef __SNIFFER_H
+#define __SNIFFER_H
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <linux/can.h>
+
+#include "CAN.hpp"
+#include "DTC.hpp"
+#include "ISO15765.hpp"
+#include "OBD.hpp"
+
+// Passive decoder of another tester's OBD-II traffic, never transmits
+class OBDSniffer
+{
+    public:
+        OBDSniffer(std::chrono::milliseconds expiry);
+
+        // OBD request and response ids, 11-bit and 29-bit
+        static const std::vector<can_filter> filters();
+
+        // Reassembles per CAN id, prints decoded requests and responses
+        void frame(const can_rx_frame &frame);
+
+    private:
+        struct pending_request
+        {
+            bool extended;
+            int ecu; // ANY_ECU for broadcast
+            int service;
+            int pid; // -1 for services without PID
+            std::chrono::steady_clock::time_point sent;
+        };
+
+        void request(const can_rx_frame &frame, const OBDAddressing &addressing, const std::vector<uint8_t> &payload);
+        void response(const can_rx_frame &frame, const OBDAddressing &addressing, const std::vector<uint8_t> &payload);
+        void timestamp(const can_rx_frame &frame) const;
+
+        const OBDAddressing normal{false};
+        const OBDAddressing extended{true};
+
+        const std::chrono::milliseconds expiry;
+        const std::chrono::steady_clock::time_point origin;
+
+        std::map<uint32_t, ISO15765Decoder> decoders;
+        DTCDecoder dtc_decoder;
+        std::vector<pending_request> pending;
+};
+
+#endif // __SNIFFER_H
@@ -0,0 +1,90 @@
+#include "Trace.hpp"
+
+#include <csignal>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+static std::mutex registry_lock;
+static std::vector<std::unique_ptr<TraceRing>> registry;
+
+// reference points to convert ticks to time
+static const uint64_t start_ticks = Trace::ticks();
+static const auto start_time = std::chrono::steady_clock::now();
+
+static std::string trace_path = "obey.trace";
+static volatile std::sig_atomic_t dump_requested = 0;
+
+static void dump_handler(int)
+{
+    dump_requested = 1;
+}
+
+TraceRing *Trace::register_thread()
+{
+    // kept after the thread exits, so its events can still be dumped
+    std::lock_guard<std::mutex> lock{registry_lock};
+    registry.push_back(std::make_unique<TraceRing>());
+
+    return registry.back().get();
+}
+
+void Trace::output_path(const std::string &path)
+{
+    trace_path = path;
+}
+
+bool Trace::dump() noexcept
+{
+    // header: magic, ticks per second, thread count
+    // per thread: event count, events oldest first
+    const uint64_t now_ticks = ticks();
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const double ticks_per_second = (elapsed > 0) ? ((now_ticks - start_ticks) / elapsed) : 1e9;
+
+    FILE *file = ::fopen(trace_path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock{registry_lock};
+
+    const uint32_t threads = registry.size();
+    ::fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, file);
+    ::fwrite(&ticks_per_second, sizeof(ticks_per_second), 1, file);
+    ::fwrite(&threads, sizeof(threads), 1, file);
+
+    for (const auto &ring : registry)
+    {
+        const uint64_t next = ring->next;
+        const uint64_t count = std::min<uint64_t>(next, TraceRing::SIZE);
+        ::fwrite(&count, sizeof(count), 1, file);
+
+        for (uint64_t i = next - count; i < next; i++)
+        {
+            ::fwrite(&ring->events[i & (TraceRing::SIZE - 1)], sizeof(trace_record), 1, file);
+        }
+    }
+
+    return ::fclose(file) == 0;
+}
+
+void Trace::install_signal()
+{
+    struct sigaction act{};
+    act.sa_handler = dump_handler;
+    ::sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    ::sigaction(SIGUSR2, &act, nullptr);
+}
+
+void Trace::poll()
+{
+    if (dump_requested)
+    {
+        dump_requested = 0;
+        dump();
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum trace_type:uint8_t {can_tx, can_rx, isotp_state, flow_control_sent, deadline_expired};
+enum trace_isotp:uint8_t {single_frame, first_frame, consecutive_frame, sequence_missed, complete, refused, invalid};
+
+// Fixed size binary event, decoded offline by obey_trace
+struct trace_record
+{
+    uint64_t ticks; // TSC where available, otherwise steady clock nanoseconds
+    uint32_t id; // CAN id
+    uint8_t type; // trace_type
+    uint8_t detail; // e.g. trace_isotp, flow_status, frame length
+    uint16_t value; // e.g. sequence, message length, block size
+    uint64_t data; // frame bytes, buffer offset, ...
+};
+static_assert(sizeof(trace_record) == 24);
+
+static const char TRACE_MAGIC[8] = {'O', 'B', 'E', 'Y', 'T', 'R', 'C', '1'};
+
+// Per-thread ring of the latest events, overwritten when full
+struct TraceRing
+{
+    static constexpr size_t SIZE = 8192; // power of two
+    std::array<trace_record, SIZE> events{};
+    uint64_t next{};
+};
+
+class Trace
+{
+    public:
+        static inline uint64_t ticks()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        static inline void record(uint8_t type, uint32_t id, uint8_t detail, uint16_t value, uint64_t data)
+        {
+            thread_local TraceRing *ring = nullptr;
+            if (__builtin_expect(ring == nullptr, 0))
+            {
+                ring = register_thread();
+            }
+
+            ring->events[ring->next++ & (TraceRing::SIZE - 1)] = {ticks(), id, type, detail, value, data};
+        }
+
+        // Binary dump of every thread's ring, events may tear while other threads record
+        // Never throws, it runs from the terminate handler; false (errno set) when not written
+        static void output_path(const std::string &path);
+        static bool dump() noexcept;
+
+        // SIGUSR2 requests a dump, performed by poll() outside the signal handler
+        static void install_signal();
+        static void poll();
+
+    private:
+        static TraceRing *register_thread();
+};
+
+// Compiled out unless built with -DOBEY_TRACE=ON
+#ifdef OBEY_TRACE
+#define OBEY_TRACE_EVENT(type, id, detail, value, data) \
+    Trace::record((type), (id), (detail), (value), (data))
+#else
+#define OBEY_TRACE_EVENT(type, id, detail, value, data) do {} while (0)
+#endif
+
+#endif // __TRACE_H
@@ -0,0 +1,330 @@
+#include "Trigger.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+static const size_t PIDS = 0x100;
+
+TriggerCapture::TriggerCapture(const std::string &expression, const std::vector<int> &pids, double rate,
+    std::chrono::milliseconds pre, std::chrono::milliseconds post, const std::string &prefix)
+: latest(PIDS), seen(PIDS), pre{ pre }, post{ post }, prefix{ prefix }
+{
+    conditions = compile(expression, pids);
+
+    const size_t pre_samples = static_cast<size_t>(std::ceil(rate * pre.count() / 1000)) + 1;
+    const size_t post_samples = static_cast<size_t>(std::ceil(rate * post.count() / 1000)) + 2;
+
+    for (const int pid : pids)
+    {
+        channel each{pid & 0xff, std::vector<trigger_sample>(pre_samples), 0, 0, {}};
+        each.after.reserve(post_samples);
+        channels.push_back(std::move(each));
+    }
+
+    collecting.samples.reserve(pids.size() * (pre_samples + post_samples));
+    ready.samples.reserve(collecting.samples.capacity());
+
+    writer = std::thread(&TriggerCapture::write_loop, this);
+}
+
+TriggerCapture::~TriggerCapture()
+{
+    finish();
+}
+
+void TriggerCapture::finish()
+{
+    if (!writer.joinable())
+    {
+        return;
+    }
+
+    if (active)
+    {
+        // wait for the writer, the partial capture is not skipped
+        std::unique_lock<std::mutex> guard{lock};
+        wake.wait(guard, [this]() { return !pending; });
+        guard.unlock();
+
+        hand_off();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        stopping = true;
+    }
+    wake.notify_all();
+    writer.join();
+
+    if (skipped > 0)
+    {
+        ::fprintf(stderr, "Trigger captures skipped while writing the one before: %llu\n", static_cast<unsigned long long>(skipped));
+    }
+}
+
+std::vector<trigger_condition> TriggerCapture::compile(const std::string &expression, const std::vector<int> &pids)
+{
+    std::vector<trigger_condition> conditions;
+
+    std::string compact;
+    std::remove_copy_if(expression.cbegin(), expression.cend(), std::back_inserter(compact), ::isspace);
+
+    std::istringstream clauses{compact};
+    std::string clause;
+    while (std::getline(clauses, clause, '|'))
+    {
+        std::istringstream comparisons{clause};
+        std::string comparison;
+        while (std::getline(comparisons, comparison, '&'))
+        {
+            // longest operators first
+            static const std::pair<const char *, trigger_operator> OPERATORS[] = {
+                {">=", trigger_operator::greater_equal}, {"<=", trigger_operator::less_equal},
+                {"==", trigger_operator::equal}, {"!=", trigger_operator::not_equal},
+                {">", trigger_operator::greater}, {"<", trigger_operator::less},
+            };
+
+            const size_t position = comparison.find_first_of("<>=!");
+            if (position == 0 || position == std::string::npos)
+            {
+                throw std::invalid_argument("Trigger: expected <pid><operator><value> in " + comparison);
+            }
+
+            const auto found = std::find_if(std::begin(OPERATORS), std::end(OPERATORS), [&](const auto &each) {
+                return comparison.compare(position, strlen(each.first), each.first) == 0;
+            });
+            if (found == std::end(OPERATORS))
+            {
+                throw std::invalid_argument("Trigger: unknown operator in " + comparison);
+            }
+
+            int pid = 0;
+            double threshold = 0;
+            try
+            {
+                pid = std::stoi(comparison.substr(0, position), nullptr, 16);
+                threshold = std::stod(comparison.substr(position + strlen(found->first)));
+            }
+            catch (const std::logic_error &)
+            {
+                throw std::invalid_argument("Trigger: expected <pid><operator><value> in " + comparison);
+            }
+
+            if (std::find(pids.cbegin(), pids.cend(), pid) == pids.cend())
+            {
+                // never sampled, the condition could never hold
+                throw std::invalid_argument("Trigger: PID " + comparison.substr(0, position) + " is not polled");
+            }
+
+            conditions.push_back({static_cast<uint8_t>(pid), found->second, threshold, false});
+        }
+
+        if (conditions.empty() || conditions.back().last)
+        {
+            throw std::invalid_argument("Trigger: empty clause");
+        }
+        conditions.back().last = true;
+    }
+
+    if (conditions.empty())
+    {
+        throw std::invalid_argument("Trigger: empty expression");
+    }
+
+    return conditions;
+}
+
+bool TriggerCapture::evaluate() const
+{
+    bool result = false;
+    bool clause = true;
+
+    for (const trigger_condition &condition : conditions)
+    {
+        const double value = latest[condition.pid];
+
+        bool holds = false;
+        switch (condition.op)
+        {
+        case trigger_operator::greater:
+            holds = value > condition.threshold;
+            break;
+        case trigger_operator::greater_equal:
+            holds = value >= condition.threshold;
+            break;
+        case trigger_operator::less:
+            holds = value < condition.threshold;
+            break;
+        case trigger_operator::less_equal:
+            holds = value <= condition.threshold;
+            break;
+        case trigger_operator::equal:
+            holds = value == condition.threshold;
+            break;
+        case trigger_operator::not_equal:
+            holds = value != condition.threshold;
+            break;
+        }
+
+        // no value yet never holds
+        clause = clause && seen[condition.pid] && holds;
+        if (condition.last)
+        {
+            result = result || clause;
+            clause = true;
+        }
+    }
+
+    return result;
+}
+
+void TriggerCapture::sample(size_t index, std::chrono::steady_clock::time_point time, double value)
+{
+    channel &each = channels[index];
+    latest[each.pid] = value;
+    seen[each.pid] = true;
+
+    // rising edge, a condition that stays true fires once
+    const bool holds = evaluate();
+    if (holds && !previous && !active)
+    {
+        active = true;
+        triggered = time;
+        dropped = 0;
+
+        // the pre-trigger window now, the rings keep going during the capture
+        collecting.samples.clear(); // keeps the capacity
+        for (channel &other : channels)
+        {
+            for (size_t i = 0; i < other.used; i++)
+            {
+                const trigger_sample &sample = other.ring[(other.next + other.ring.size() - other.used + i) % other.ring.size()];
+                if (sample.time >= triggered - pre)
+                {
+                    collecting.samples.push_back({sample.time, other.pid, sample.value});
+                }
+            }
+            other.after.clear();
+        }
+    }
+    previous = holds;
+
+    each.ring[each.next] = {time, value};
+    each.next = (each.next + 1) % each.ring.size();
+    each.used = std::min(each.used + 1, each.ring.size());
+
+    if (active)
+    {
+        if (each.after.size() < each.after.capacity())
+        {
+            each.after.push_back({time, value});
+        }
+        else
+        {
+            dropped++;
+        }
+
+        if (time - triggered >= post)
+        {
+            hand_off();
+        }
+    }
+}
+
+void TriggerCapture::hand_off()
+{
+    active = false;
+    for (const channel &each : channels)
+    {
+        for (const trigger_sample &sample : each.after)
+        {
+            collecting.samples.push_back({sample.time, each.pid, sample.value});
+        }
+    }
+
+    // wall clock time of the trigger
+    const time_t wall = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() -
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - triggered));
+
+    {
+        std::lock_guard<std::mutex> guard{lock};
+        if (pending)
+        {
+            // the writer has not taken the one before yet
+            skipped++;
+            return;
+        }
+
+        collecting.triggered = triggered;
+        collecting.wall = wall;
+        collecting.number = ++written;
+        collecting.dropped = dropped;
+        std::swap(collecting, ready);
+        pending = true;
+    }
+    wake.notify_all();
+}
+
+void TriggerCapture::write_loop()
+{
+    std::unique_lock<std::mutex> guard{lock};
+
+    capture writing{};
+    writing.samples.reserve(ready.samples.capacity());
+
+    while (true)
+    {
+        wake.wait(guard, [this]() { return pending || stopping; });
+        if (!pending)
+        {
+            return;
+        }
+
+        std::swap(ready, writing);
+        pending = false;
+        guard.unlock();
+        wake.notify_all();
+
+        write(writing);
+
+        guard.lock();
+    }
+}
+
+void TriggerCapture::write(capture &done) const
+{
+    std::sort(done.samples.begin(), done.samples.end(), [](const ordered_sample &a, const ordered_sample &b) {
+        return (a.time < b.time) || (a.time == b.time && a.pid < b.pid);
+    });
+
+    char path[256];
+    ::snprintf(path, sizeof(path), "%s-%lld-%llu.csv", prefix.c_str(), static_cast<long long>(done.wall),
+        static_cast<unsigned long long>(done.number));
+
+    FILE *file = ::fopen(path, "w");
+    if (file == nullptr)
+    {
+        // polling goes on, the capture is lost
+        ::fprintf(stderr, "Trigger capture %s: %s\n", path, ::strerror(errno));
+        return;
+    }
+
+    ::fprintf(file, "# trigger %lld\ntime,pid,value\n", static_cast<long long>(done.wall));
+    for (const ordered_sample &sample : done.samples)
+    {
+        ::fprintf(file, "%.6f,%02x,%g\n", std::chrono::duration<double>(sample.time - done.triggered).count(), sample.pid, sample.value);
+    }
+    ::fclose(file);
+
+    ::fprintf(stderr, "Trigger capture %s, %zu samples, %llu dropped\n", path, done.samples.size(),
+        static_cast<unsigned long long>(done.dropped));
+}
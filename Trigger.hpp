@@ -0,0 +1,114 @@
+#ifndef __TRIGGER_H
+#define __TRIGGER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class trigger_operator:uint8_t {greater, greater_equal, less, less_equal, equal, not_equal};
+
+// One comparison of the latest value of a PID
+struct trigger_condition
+{
+    uint8_t pid;
+    trigger_operator op;
+    double threshold;
+    bool last; // of its AND clause
+};
+
+// Captures the samples around the moment a condition comes true
+// The expression is ORs of ANDs of PID comparisons, e.g. "0c>3000&0d<10|05>=110",
+// compiled once into a flat list. It fires when it changes from false to true.
+// Each channel keeps a ring of its latest samples for the pre-trigger window; after
+// a trigger, samples also go to a post-trigger buffer until the post window passed.
+// The capture is then handed to a writer thread, which sorts it and writes it as CSV,
+// so sampling never waits for the file. All buffers are allocated up front.
+class TriggerCapture
+{
+    public:
+        // pids: the channels in sample order; rate: samples per second per channel
+        TriggerCapture(const std::string &expression, const std::vector<int> &pids, double rate,
+            std::chrono::milliseconds pre, std::chrono::milliseconds post, const std::string &prefix = "capture");
+        ~TriggerCapture();
+
+        void sample(size_t channel, std::chrono::steady_clock::time_point time, double value);
+
+        // writes a capture cut short by the end of polling and waits for the writer
+        void finish();
+
+        // std::invalid_argument when malformed or on a PID not in pids
+        static std::vector<trigger_condition> compile(const std::string &expression, const std::vector<int> &pids);
+
+        uint64_t captures() const { return written; }
+        bool capturing() const { return active; }
+
+    private:
+        struct trigger_sample
+        {
+            std::chrono::steady_clock::time_point time;
+            double value;
+        };
+
+        struct channel
+        {
+            int pid;
+            std::vector<trigger_sample> ring; // pre-trigger, overwritten
+            size_t next;
+            size_t used;
+            std::vector<trigger_sample> after; // post-trigger, capacity reserved
+        };
+
+        struct ordered_sample
+        {
+            std::chrono::steady_clock::time_point time;
+            int pid;
+            double value;
+        };
+
+        struct capture
+        {
+            std::vector<ordered_sample> samples; // capacity reserved
+            std::chrono::steady_clock::time_point triggered;
+            time_t wall; // of the trigger
+            uint64_t number;
+            uint64_t dropped; // post-trigger samples beyond the reserved capacity
+        };
+
+        bool evaluate() const;
+        void hand_off();
+        void write_loop();
+        void write(capture &done) const;
+
+        std::vector<trigger_condition> conditions;
+        std::vector<double> latest; // by PID
+        std::vector<bool> seen; // by PID
+
+        std::vector<channel> channels;
+
+        const std::chrono::milliseconds pre;
+        const std::chrono::milliseconds post;
+        const std::string prefix;
+
+        bool previous{};
+        bool active{};
+        std::chrono::steady_clock::time_point triggered;
+        uint64_t written{};
+        uint64_t dropped{};
+        uint64_t skipped{}; // completed while the writer was still busy
+
+        // collecting: filled while sampling; ready: handed off; the writer swaps ready with its own
+        capture collecting{};
+        capture ready{};
+        std::mutex lock;
+        std::condition_variable wake;
+        bool pending{}; // ready holds a capture
+        bool stopping{};
+        std::thread writer;
+};
+
+#endif // __TRIGGER_H
@@ -5,40 +5,111 @@
 #include <functional>
 #include <iostream>
 #include <chrono>
-
+#include <map>
+#include <memory>
+#include <optional>
+#include <csignal>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "BinaryLog.hpp"
+#include "BusLoad.hpp"
 #include "CAN.hpp"
+#include "DTC.hpp"
+#include "DeltaFilter.hpp"
 #include "ISO15765.hpp"
+#include "Metrics.hpp"
+#include "OBD.hpp"
+#include "OBDClient.hpp"
+#include "OBDDescriptor.hpp"
+#include "PID.hpp"
+#include "SharedValues.hpp"
+#include "Sniffer.hpp"
+#include "Trace.hpp"
+#include "Trigger.hpp"
 
 using namespace std::chrono_literals;
 
-const uint32_t OBD_BROADCAST = 0x7df;
-const uint32_t OBD_ECU_SEND_BASE = 0x7e0;
-const uint32_t OBD_ECU_RECV_BASE = OBD_ECU_SEND_BASE + 8;
-
-const uint8_t OBD_PAD_BYTE = 0xCC;
-
-const auto RESPONSE_WAIT = 1s;
-
-const int MAX_ECUS = 8;
-const int ANY_ECU = -1;
-
 const int MIN_SERVICE = 0x00;
 const int MAX_SERVICE = 0x3f;
 const int MIN_PID = 0x00;
 const int MAX_PID = 0xffff;
-const int MAX_STANDARD_PID = 0xff;
-const uint8_t UNKNOWN_RESPONSE = 0x3f;
 
-const int VEHICLE_INFO_SERVICE = 0x09;
-const int SHOW_DATA_SERVICE = 0x01;
-const int SHOW_FREEZE_FRAME_SERVICE = 0x02;
+// Supported PIDs of show data, 7 pages of 0x20; 0x01-0xe0
+using show_data_pages = supported_pid_pages<obd_service::show_data, std::tuple_size_v<obd_capabilities>>;
+
+using can_data = obd_frame;
+
+ISO15765FlowControl flow_control{};
+DTCDecoder dtc_decoder; // buffer reused by every DTC list
+
+// Continuous polling
+double poll_rate = 20.0; // Hz, each PID once per period
+std::chrono::milliseconds poll_heartbeat{}; // 0 = only changes
 
-enum fault_code_source:uint8_t {stored = 0x03 /* default */, pending = 0x07, permanent = 0x0a};
+std::string log_file; // binary log of polled samples and sniffed frames
+std::string shared_values; // shared memory table of the latest polled values
 
-using can_data = std::array<uint8_t, 8>;
+std::string trigger_expression; // capture around the moment this comes true
+std::chrono::milliseconds trigger_pre = 5s;
+std::chrono::milliseconds trigger_post = 5s;
 
-auto wait_override = RESPONSE_WAIT;
+std::unique_ptr<BusPacer> pacer; // requests under a bus load target
 
+std::string metrics_file; // Prometheus text on exit and SIGUSR1, stderr when empty
+
+auto fault_interval = 10s; // watch-faults
+const int FAULT_LOST_ROUNDS = 3; // watch-faults rounds without any answer before an ECU is dropped
+volatile std::sig_atomic_t quit = 0;
+
+// A command and its options, from the command line or a batch script line
+struct command
+{
+    std::string name{"help"};
+    std::string argument{};
+    int ecu{ANY_ECU};
+    int service{-1};
+    int pid{-1};
+    std::chrono::seconds wait{}; // 0 = default
+};
+
+// To the -M file, a failure is reported and polling goes on
+void write_metrics()
+{
+    try
+    {
+        Metrics::write();
+    }
+    catch (const std::system_error &error)
+    {
+        std::cerr << error.what() << std::endl;
+    }
+}
+
+// Dump requested by SIGUSR1
+void poll_metrics()
+{
+    if (!Metrics::poll())
+    {
+        return;
+    }
+
+    if (metrics_file.empty())
+    {
+        std::cerr << Metrics::prometheus();
+    }
+    else
+    {
+        write_metrics();
+    }
+}
 
 void foreach_pid(uint32_t features, std::function<void(int)> callback)
 {
@@ -51,402 +122,858 @@ void foreach_pid(uint32_t features, std::function<void(int)> callback)
     }
 }
 
-void do_until_expire(std::function<bool()> what)
+
+
+void print_ecu(const OBDAddressing &addressing, int ecu)
 {
-    const std::chrono::milliseconds wait = wait_override;
-    const auto expire = std::chrono::system_clock::now() + wait;
-    bool abort = false;
-    while(std::chrono::system_clock::now() < expire && !abort)
+    std::cout << " (0x" << std::hex << (addressing.request_id(ecu) & CAN_EFF_MASK)
+        << "/0x" << (addressing.response_id(ecu) & CAN_EFF_MASK) << std::dec
+        << ") :" << std::endl;
+}
+
+void read_info(OBDClient &client, int ecu = ANY_ECU)
+{
+    const std::optional<obd_supported> info = client.vehicle_info(ecu);
+    if (!info)
     {
-        abort = what();
+        return;
     }
-}
 
+    if (ecu < 0)
+    {
+        std::cout << "ECU: " << info->ecu;
+        print_ecu(client.addressing(), info->ecu);
+    }
 
-const std::string decode_dtc(uint16_t dtc)
-{
-    char code[6] = {'\x00'};
-    switch(dtc >> 14)
-    {
-    case 0b00:
-        code[0] = 'P';
-        break;
-    case 0b01:
-        code[0] = 'C';
-        break;
-    case 0b10:
-        code[0] = 'B';
-        break;
-    case 0b11:
-        code[0] = 'U';
-        break;
-    }
-
-    code[1] = ((dtc >> 12) & 0x03) + '0';
-
-    code[2] = ((dtc >> 8) & 0x0f);
-    code[3] = ((dtc >> 4) & 0x0f);
-    code[4] = (dtc & 0x0f);
-
-    code[2] = (code[2] > 0x09) ? (code[2] + '7') : (code[2] + '0');
-    code[3] = (code[3] > 0x09) ? (code[3] + '7') : (code[3] + '0');
-    code[4] = (code[4] > 0x09) ? (code[4] + '7') : (code[4] + '0');
-
-    return std::string{code};
+    printf("    Available vehicle information (service=0x09): 0x%08x\n", info->supported);
+    std::cout << "    ";
+    foreach_pid(info->supported, [&](int pid) { printf("%02X,", pid); });
+    std::cout << std::endl << std::endl;
 }
 
-const std::vector<uint8_t> receive_multipart(CANDevice &can)
+
+void enumerate(OBDClient &client)
 {
-    ISO15765Decoder decoder;
+    const int FEATURE_PAGE_SIZE = show_data_pages::PAGE_SIZE;
 
-    bool more = true;
-    bool first = false;
+    std::cerr << "Waiting for ECUs to respond..." << std::endl;
 
-    can_data buffer{};
+    // ECUs are discovered by their response id (source address with 29-bit)
+    const std::map<int, obd_capabilities> ecus = client.enumerate();
 
-    do_until_expire([&]() -> bool {
-        uint32_t id = 0;
+    if (ecus.empty())
+    {
+        std::cout << "No ECUs found" << std::endl;
+        return;
+    }
 
-        if (!can.data_receive(id, buffer))
+    // Print the ECU responses and pages then collect the ECU available info
+    for (const auto &[ecu, pages] : ecus)
+    {
+        if (pages[0] == 0)
         {
-            return false;
+            // ECU responded without any features
+            continue;
         }
 
-        more = decoder.add_fragment(buffer);
+        // Print the discovered ECU
+        std::cout << "Found ECU: " << ecu;
+        print_ecu(client.addressing(), ecu);
 
-        if (more)
+        // Pages of read data service 0x01
+        for (size_t page = 0; page < pages.size() && pages[page] != 0; page++)
         {
-            if (!first)
+            const int offset = page * FEATURE_PAGE_SIZE;
+
+            printf("    Available data (service=0x01) [%02X-%02X]: 0x%08x\n",
+                    (offset + 1), // first feature
+                    (offset + FEATURE_PAGE_SIZE), //last feature
+                    pages[page]
+            );
+            std::cout << "    ";
+            foreach_pid(pages[page], [&](int pid) { printf("%02X,", pid + offset); });
+            std::cout << std::endl << std::endl;
+
+            if (! ( pages[page] & 0x01 ) )
             {
-                std::fill(buffer.begin(), buffer.end(), 0x00);
-                buffer[0] = 0x30; // flow control, enable all remaining parts
-                can.data_send(id - 8, buffer);
-                first = true;
+                // No more extra pages
+                break;
             }
-
-            return false;
         }
 
-        return true; // expire the loop
-    });
+        // Enumerate available vehicle info 0x09
+        read_info(client, ecu);
+    }
+}
+
+void clear_dtc(OBDClient &client, int ecu = ANY_ECU)
+{
+    client.clear_dtc(ecu);
 
-    return decoder.get_data();
+    std::cerr << "Cleared DTC" << std::endl;
 }
 
-uint32_t read_features(const can_data &buffer)
+// A line per code, with the description of generic codes
+void append_dtcs(std::string &output, std::string_view prefix, std::span<const dtc_entry> dtcs)
 {
-    if ((buffer[1] & UNKNOWN_RESPONSE) == UNKNOWN_RESPONSE)
+    for (const dtc_entry &dtc : dtcs)
     {
-        // Response id was unknown, therefore no features possible
-        return 0;
-    }
+        output.append(prefix);
+        output.append(dtc.text, 5);
 
-    return (buffer[3] << 24 | buffer[4] << 16 | buffer[5] << 8 | buffer[6]);
+        const char *description = dtc_description(dtc.code);
+        if (description != nullptr)
+        {
+            output.push_back(' ');
+            output.append(description);
+        }
+        output.push_back('\n');
+    }
 }
 
-
-void read_info(CANDevice &can, int ecu = ANY_ECU)
+template <obd_service Source>
+void read_dtc(OBDClient &client, int ecu = ANY_ECU)
 {
-    can_data buffer{};
-    std::fill(buffer.begin(), buffer.end(), OBD_PAD_BYTE);
+    const std::optional<obd_dtcs> found = client.read_dtc<Source>(dtc_decoder, ecu);
 
-    // Generate ISO-15765 headers + OBD-II command
-    buffer[1] = 0x09; // Service 9
-    buffer[2] = 0x00; // Get supported PIDs (1-20)
-    buffer[0] = 0x02; // Single frame + length
-
-    if (ecu < 0)
+    if (!found)
     {
-        // Broadcast to all ECUs
-        can.filter(OBD_ECU_RECV_BASE, ~0x07);
-        can.data_send(OBD_BROADCAST, buffer);
+        // unknown service
+        return;
     }
-    else
+
+    std::string output{"Diagnostic trouble codes:\n"};
+    append_dtcs(output, "", found->dtcs);
+
+    // one write for the whole list
+    std::fwrite(output.data(), 1, output.size(), stdout);
+    std::fflush(stdout);
+}
+
+// Polls stored, pending and permanent DTCs of every ECU (or one), prints the codes as they appear and clear
+void watch_faults(OBDClient &client, int ecu_filter = ANY_ECU)
+{
+    struct fault_source
     {
-        can.filter(ecu + OBD_ECU_RECV_BASE);
-        can.data_send(ecu + OBD_ECU_SEND_BASE, buffer);
-    }
+        const char *name;
+        obd_service service;
+        const can_data &frame;
+    };
+    const fault_source sources[] = {
+        {"stored", obd_service::stored_dtc, dtc_list<obd_service::stored_dtc>::request::frame},
+        {"pending", obd_service::pending_dtc, dtc_list<obd_service::pending_dtc>::request::frame},
+        {"permanent", obd_service::permanent_dtc, dtc_list<obd_service::permanent_dtc>::request::frame},
+    };
+
+    // sorted DTC sets by (ECU, source)
+    std::map<std::pair<int, int>, std::vector<uint16_t>> current;
+    std::map<int, int> silent; // rounds without an answer, by ECU
+    std::vector<int> answered;
+    std::vector<uint16_t> latest;
+    std::vector<uint16_t> appeared;
+    std::vector<uint16_t> cleared;
+    std::string output;
+
+    std::signal(SIGINT, [](int) { quit = 1; });
+    std::signal(SIGTERM, [](int) { quit = 1; });
+
+    std::cerr << "Watching faults every " << fault_interval.count() << "s. Ctrl-C to stop" << std::endl;
+
+    auto next = std::chrono::steady_clock::now();
+    while (!quit)
+    {
+        answered.clear();
+        for (size_t source = 0; source < std::size(sources) && !quit; source++)
+        {
+            std::map<int, std::vector<uint8_t>> responses;
+            if (ecu_filter == ANY_ECU)
+            {
+                // done once every ECU still known has answered
+                responses = client.broadcast(sources[source].frame, sources[source].service, silent.size());
+            }
+            else
+            {
+                client.send(sources[source].frame, ecu_filter);
+
+                int responder = ANY_ECU;
+                std::vector<uint8_t> response = client.receive(sources[source].service, 0x00, &responder);
+                if (responder != ANY_ECU)
+                {
+                    responses.emplace(responder, std::move(response));
+                }
+            }
 
-    do_until_expire([&]() -> bool {
-        uint32_t id = 0;
+            const time_t now = std::time(nullptr);
+            for (const auto &[ecu, response] : responses)
+            {
+                // even a negative response shows the ECU is there
+                answered.push_back(ecu);
+
+                if (response.empty() || response[0] != (sources[source].service | OBD_RESPONSE_OFFSET))
+                {
+                    // incomplete or negative, the previous set stays
+                    continue;
+                }
+
+                std::vector<uint16_t> &known = current[{ecu, source}];
+                dtc_set(dtc_decoder.decode(response), latest);
+                diff_dtcs(known, latest, appeared, cleared);
+
+                if (!appeared.empty() || !cleared.empty())
+                {
+                    char appear[64];
+                    char clear[64];
+                    std::snprintf(appear, sizeof(appear), "%lld ECU %d %s APPEAR ", static_cast<long long>(now), ecu, sources[source].name);
+                    std::snprintf(clear, sizeof(clear), "%lld ECU %d %s CLEAR ", static_cast<long long>(now), ecu, sources[source].name);
+
+                    append_dtcs(output, appear, dtc_decoder.decode(appeared, dtc_status(sources[source].service)));
+                    append_dtcs(output, clear, dtc_decoder.decode(cleared));
+                }
+
+                known.swap(latest);
+            }
+        }
 
-        if (can.data_receive(id, buffer))
+        // ECUs that stopped answering clear all of their codes
+        const time_t now = std::time(nullptr);
+        for (const int ecu : answered)
         {
-            if (ecu < 0)
+            silent[ecu] = 0;
+        }
+        for (auto each = silent.begin(); each != silent.end() && !quit;)
+        {
+            if (std::find(answered.cbegin(), answered.cend(), each->first) != answered.cend() ||
+                ++each->second < FAULT_LOST_ROUNDS)
+            {
+                ++each;
+                continue;
+            }
+
+            const int ecu = each->first;
+            char lost[64];
+            std::snprintf(lost, sizeof(lost), "%lld ECU %d LOST\n", static_cast<long long>(now), ecu);
+            output.append(lost);
+            for (size_t source = 0; source < std::size(sources); source++)
             {
-                std::cout << "ECU: " << id - OBD_ECU_RECV_BASE
-                    << " (0x" << std::hex << id + OBD_ECU_SEND_BASE - OBD_ECU_RECV_BASE
-                    << "/0x" << id << std::dec
-                    << ") :" << std::endl;
+                const auto found = current.find({ecu, source});
+                if (found == current.end())
+                {
+                    continue;
+                }
+
+                char clear[64];
+                std::snprintf(clear, sizeof(clear), "%lld ECU %d %s CLEAR ", static_cast<long long>(now), ecu, sources[source].name);
+                append_dtcs(output, clear, dtc_decoder.decode(found->second));
+                current.erase(found);
             }
 
-            const uint32_t features = read_features(buffer);
+            each = silent.erase(each);
+        }
 
-            printf("    Available vehicle information (service=0x09): 0x%08x\n", features);
-            std::cout << "    ";
-            foreach_pid(features, [&](int pid) { printf("%02X,", pid); });
-            std::cout << std::endl << std::endl;
+        // the changes of a round in one write
+        std::fwrite(output.data(), 1, output.size(), stdout);
+        std::fflush(stdout);
+        output.clear();
 
-            return true;
+        // short sleeps, so Ctrl-C is not held up by the interval
+        next = std::max(next + fault_interval, std::chrono::steady_clock::now());
+        while (!quit && std::chrono::steady_clock::now() < next)
+        {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(100ms, next - std::chrono::steady_clock::now()));
+            poll_metrics();
         }
-        return false;
-    });
+    }
 }
 
+bool valid_request(int service, int pid)
+{
+    if (service < MIN_SERVICE || service > MAX_SERVICE)
+    {
+        std::cerr << "Impossible Service ID" << std::endl;
+        return false;
+    }
+
+    if (pid < MIN_PID || pid > MAX_PID)
+    {
+        std::cerr << "Impossible PID" << std::endl;
+        return false;
+    }
 
-void enumerate(CANDevice &can)
+    return true;
+}
+
+void print_results(const std::optional<obd_reply> &reply)
 {
-    const int FEATURE_PAGE_SIZE = 0x20;
-    const int MAX_DATAS = 7; // 7 pages of info of length 0x20; 0x01-0xe0
+    if (!reply)
+    {
+        // unknown service
+        return;
+    }
 
-    // Accept all IDs between 0x7e8 - 0x7ef
-    can.filter(OBD_ECU_RECV_BASE, ~0x07);
+    printf("Results (Service: %02x, PID: %02x, length: %i)\n", reply->service, reply->pid, static_cast<int>( reply->data.size() - reply->offset ) );
 
-    can_data buffer{};
-    std::fill(buffer.begin(), buffer.end(), OBD_PAD_BYTE);
+    for (size_t i = reply->offset; i < reply->data.size(); i++)
+    {
+        printf("%02x", reply->data[i]);
+    }
 
-    // Generate ISO-15765 headers + OBD-II command
-    buffer[1] = 0x01; // Service 1
-    buffer[2] = 0x00; // Get supported PIDs (1-20)
-    buffer[0] = 0x02; // single frame, length
+    std::cout << std::endl;
+}
+
+void request(OBDClient &client, int service, int pid, int ecu = ANY_ECU)
+{
+    if (!valid_request(service, pid))
+    {
+        return;
+    }
 
-    can.data_send(OBD_BROADCAST, buffer);
+    print_results(client.request(service, pid, ecu));
+}
 
-    std::array<uint32_t, MAX_ECUS> ecu_features{};
-    std::fill(ecu_features.begin(), ecu_features.end(), 0);
+void sniff(CANDevice &can, std::chrono::milliseconds expiry)
+{
+    can.filter(OBDSniffer::filters());
 
-    bool found = false;
+    OBDSniffer sniffer{expiry};
 
-    std::cerr << "Waiting for ECUs to respond..." << std::endl;
+    // passive, no VIN or capabilities in the header
+    std::unique_ptr<LogWriter> log;
+    if (!log_file.empty())
+    {
+        log = std::make_unique<LogWriter>(log_file, log_header{});
+    }
+
+    std::signal(SIGINT, [](int) { quit = 1; });
+    std::signal(SIGTERM, [](int) { quit = 1; });
 
-    // Wait for ECU responses
-    do_until_expire([&]() -> bool {
-        uint32_t can_id = 0;
-        can_data buffer{};
+    std::cerr << "Sniffing, never transmits. Ctrl-C to stop" << std::endl;
 
-        if (can.data_receive(can_id, buffer))
+    while (!quit)
+    {
+        can_rx_frame frame{};
+        if (can.frame_receive(frame))
         {
-            const int ecu_index = can_id - OBD_ECU_RECV_BASE;
-            found = true;
-            ecu_features[ecu_index] = read_features(buffer);
+            if (log)
+            {
+                log->frame(frame);
+            }
+            sniffer.frame(frame);
+        }
+        else
+        {
+            // idle, let the output catch up
+            std::fflush(stdout);
         }
 
-        return false;
-    });
+        poll_metrics();
+#ifdef OBEY_TRACE
+        Trace::poll();
+#endif
+    }
 
-    if (!found)
+    std::fflush(stdout);
+}
+
+// VIN and supported show data PIDs of the ECU, for the binary log header
+log_header session_header(OBDClient &client, int ecu)
+{
+    log_header header{};
+    header.vin = client.vin(ecu, &ecu).value_or("");
+
+    if (ecu == ANY_ECU)
     {
-        std::cout << "No ECUs found" << std::endl;
-        return;
+        return header;
     }
 
-    // Print the ECU responses and check for next page then collect the ECU available info
-    for (int ecu = 0; ecu < MAX_ECUS; ecu++)
+    header.capabilities[ecu] = client.supported_pids(ecu);
+
+    return header;
+}
+
+// PIDs of a poll list "0c,0d:50,05:1", with an optional deadband after the colon
+bool parse_poll_list(const std::string &list, std::vector<const pid_info *> &pids, DeltaFilter &filter)
+{
+    std::istringstream items{list};
+    std::string item;
+    while (std::getline(items, item, ','))
     {
-        uint32_t features = ecu_features[ecu];
+        const size_t colon = item.find(':');
+        const int pid = std::stol(item.substr(0, colon), nullptr, 16);
 
-        if (features == 0)
+        const pid_info *info = find_pid(pid);
+        if (info == nullptr)
         {
-            // No ECU found for current slot
-            continue;
+            std::cerr << "Unknown PID " << item.substr(0, colon) << ", poll takes decodable show data PIDs" << std::endl;
+            return false;
         }
 
-        const uint32_t send_id = ecu + OBD_ECU_SEND_BASE;
-        const uint32_t recv_id = ecu + OBD_ECU_RECV_BASE;
+        if (colon != std::string::npos)
+        {
+            filter.deadband(pid, std::stod(item.substr(colon + 1)));
+        }
+        pids.push_back(info);
+    }
 
-        // Print the discovered ECU
-        std::cout << "Found ECU: " << ecu
-                    << " (0x" << std::hex << send_id
-                    << "/0x" << recv_id << std::dec
-                    << ") :" << std::endl;
+    return !pids.empty();
+}
 
-        // Enumerate additional pages of read data service 0x01
-        for (int page = 0; page < MAX_DATAS; page++)
-        {
-            const int offset = page * FEATURE_PAGE_SIZE;
+// PID list of a poll command, a single -p PID without a list
+std::string poll_list(const command &cmd)
+{
+    std::ostringstream list;
+    if (cmd.argument.empty() && cmd.pid >= 0)
+    {
+        list << std::hex << cmd.pid;
+    }
+    else
+    {
+        list << cmd.argument;
+    }
 
-            if (page > 0)
-            {
-                // Send request to ECU for next page of available info
-                features = 0;
+    return list.str();
+}
+
+// Compiles the -g expression for the PIDs of a poll command, std::invalid_argument when it is bad
+void check_trigger(const command &cmd)
+{
+    DeltaFilter filter{poll_heartbeat};
+    std::vector<const pid_info *> pids;
+    if (trigger_expression.empty() || !parse_poll_list(poll_list(cmd), pids, filter))
+    {
+        return;
+    }
+
+    std::vector<int> channels;
+    for (const pid_info *info : pids)
+    {
+        channels.push_back(info->pid);
+    }
+    TriggerCapture::compile(trigger_expression, channels);
+}
 
-                buffer[2] = (uint8_t)offset; // Get supported PIDs (1-20) + 0x20 * page
+// Polls show data PIDs until interrupted, printing only the values that changed beyond their deadband
+void poll(OBDClient &client, const command &cmd)
+{
+    DeltaFilter filter{poll_heartbeat};
+    std::vector<const pid_info *> pids;
 
-                can.filter(recv_id);
-                can.data_send(send_id, buffer);
-                do_until_expire([&]() -> bool {
-                    uint32_t can_id = 0;
-                    can_data buffer{};
+    if (!parse_poll_list(poll_list(cmd), pids, filter))
+    {
+        std::cerr << "Nothing to poll" << std::endl;
+        return;
+    }
 
-                    if (can.data_receive(can_id, buffer))
-                    {
-                        features = read_features(buffer);
+    std::unique_ptr<LogWriter> log;
+    if (!log_file.empty())
+    {
+        log = std::make_unique<LogWriter>(log_file, session_header(client, cmd.ecu));
+    }
 
-                        return true;
-                    }
+    std::unique_ptr<SharedValueTable> table;
+    if (!shared_values.empty())
+    {
+        table = std::make_unique<SharedValueTable>(shared_values);
+    }
 
-                    return false;
-                });
-            }
+    std::unique_ptr<TriggerCapture> trigger;
+    if (!trigger_expression.empty())
+    {
+        std::vector<int> channels;
+        for (const pid_info *info : pids)
+        {
+            channels.push_back(info->pid);
+        }
+        try
+        {
+            trigger = std::make_unique<TriggerCapture>(trigger_expression, channels, poll_rate, trigger_pre, trigger_post);
+        }
+        catch (const std::invalid_argument &error)
+        {
+            // a batch line with PIDs the expression does not fit
+            std::cerr << error.what() << std::endl;
+            return;
+        }
+    }
+
+    std::signal(SIGINT, [](int) { quit = 1; });
+    std::signal(SIGTERM, [](int) { quit = 1; });
 
-            if (features == 0)
+    const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / poll_rate));
+    const auto origin = std::chrono::steady_clock::now();
+    auto next = origin;
+
+    while (!quit)
+    {
+        for (size_t channel = 0; channel < pids.size(); channel++)
+        {
+            const pid_info *info = pids[channel];
+            const std::optional<obd_value> sample = client.read_pid(*info, cmd.ecu);
+            if (!sample)
             {
-                // No more extra pages
-                break;
+                continue;
             }
 
+            const auto now = std::chrono::steady_clock::now();
+            const int responder = sample->ecu;
+            const double value = sample->value;
 
-            printf("    Available data (service=0x01) [%02X-%02X]: 0x%08x\n",
-                    (offset + 1), // first feature
-                    (offset + FEATURE_PAGE_SIZE), //last feature
-                    features
-            );
-            std::cout << "    ";
-            foreach_pid(features, [&](int pid) { printf("%02X,", pid + offset); });
-            std::cout << std::endl << std::endl;
+            if (trigger)
+            {
+                trigger->sample(channel, now, value);
+            }
 
-            if (! ( features & 0x01 ) )
+            if (table)
             {
-                // No more extra pages
-                break;
+                // every sample, local readers want the latest regardless of the deadband
+                table->publish(responder, obd_service::show_data, info->pid, value,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+            }
+
+            // suppressed samples are never formatted
+            if (filter.update(info->pid, value, now))
+            {
+                if (log)
+                {
+                    log->sample(log->channel(responder, obd_service::show_data, info->pid), now, value);
+                    continue;
+                }
+
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - origin);
+                printf("%lld %02x %s = %g %s\n", static_cast<long long>(elapsed.count()), info->pid, info->name, value, info->unit);
             }
         }
+        std::fflush(stdout);
 
-        // Enumerate available vehicle info 0x09
-        read_info(can, ecu);
+        next += period;
+        const auto now = std::chrono::steady_clock::now();
+        if (next < now)
+        {
+            // overrun, do not try to catch up
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
     }
+
+    if (trigger)
+    {
+        // a capture still open at Ctrl-C, with its post window cut short
+        trigger->finish();
+    }
+
+    std::cerr << "Emitted " << filter.emitted() << ", suppressed " << filter.suppressed() << std::endl;
 }
 
-void clear_dtc(CANDevice &can, int ecu = ANY_ECU)
+// Value of the option at i, which moves past it
+const std::string &option_value(const std::vector<std::string> &args, size_t &i)
 {
-    can_data buffer{};
-    std::fill(buffer.begin(), buffer.end(), OBD_PAD_BYTE);
+    if (i + 1 >= args.size())
+    {
+        throw std::invalid_argument("Missing value for " + args[i]);
+    }
 
-    // Generate ISO-15765 headers + OBD-II command
-    buffer[1] = 0x04; // Service 4
-    buffer[0] = 0x01; // single frame, length
+    return args[++i];
+}
 
-    if (ecu < 0)
+// Options of a command, all of them take a value
+bool command_option(command &cmd, const std::vector<std::string> &args, size_t &i)
+{
+    const std::string &arg = args[i];
+    if (arg != "-s" && arg != "-p" && arg != "-e" && arg != "-t")
+    {
+        return false;
+    }
+
+    if (arg == "-s")
+    {
+        cmd.service = std::stol(option_value(args, i), nullptr, 16);
+    }
+    else if (arg == "-p")
     {
-        // Broadcast to all ECUs
-        can.data_send(OBD_BROADCAST, buffer);
+        cmd.pid = std::stol(option_value(args, i), nullptr, 16);
+    }
+    else if (arg == "-e")
+    {
+        cmd.ecu = std::stol(option_value(args, i), nullptr, 16);
     }
     else
     {
-        can.data_send(ecu + OBD_ECU_SEND_BASE, buffer);
+        cmd.wait = std::chrono::seconds(std::stol(option_value(args, i)));
     }
 
-    std::cerr << "Cleared DTC" << std::endl;
+    return true;
 }
 
-void read_dtc(CANDevice &can, int ecu = ANY_ECU, fault_code_source service = stored)
+
+bool run_command(CANDevice &can, OBDClient &client, const command &cmd)
 {
-    can_data buffer{};
-    std::fill(buffer.begin(), buffer.end(), OBD_PAD_BYTE);
+    const auto wait = client.wait();
+    if (cmd.wait.count() > 0)
+    {
+        client.wait(cmd.wait);
+    }
 
-    // Generate ISO-15765 headers + OBD-II command
-    buffer[1] = service; // Service 3
-    buffer[0] = 0x01; // single frame, length
+    bool known = true;
 
-    if (ecu < 0)
+    if (cmd.name == "enum" || cmd.name == "list")
     {
-        // Broadcast to all ECUs
-        can.filter(OBD_ECU_RECV_BASE, ~0x07);
-        can.data_send(OBD_BROADCAST, buffer);
+        // enumerate the ECUs
+        enumerate(client);
     }
-    else
+    else if (cmd.name == "show" || cmd.name == "data")
     {
-        can.filter(ecu + OBD_ECU_RECV_BASE);
-        can.data_send(ecu + OBD_ECU_SEND_BASE, buffer);
+        request(client, obd_service::show_data, cmd.pid, cmd.ecu);
     }
-
-    const std::vector<uint8_t> defragmented = receive_multipart(can);
-
-    if (defragmented.empty() || (defragmented[0] & UNKNOWN_RESPONSE) != service)
+    else if (cmd.name == "frozen" || cmd.name == "freeze")
     {
-        // unknown service
-        return;
+        request(client, obd_service::freeze_frame, cmd.pid, cmd.ecu);
     }
-
-    std::cout << "Diagnostic trouble codes:" << std::endl;
-
-    for (int i = 1; i < static_cast<int>( defragmented.size() -1 ); i++)
+    else if (cmd.name == "clear")
+    {
+        // Clear DTCs
+        clear_dtc(client, cmd.ecu);
+    }
+    else if (cmd.name == "faults" || cmd.name == "dtc")
+    {
+        read_dtc<obd_service::stored_dtc>(client, cmd.ecu);
+    }
+    else if (cmd.name == "pending")
+    {
+        read_dtc<obd_service::pending_dtc>(client, cmd.ecu);
+    }
+    else if (cmd.name == "permanent" || cmd.name == "perm")
+    {
+        read_dtc<obd_service::permanent_dtc>(client, cmd.ecu);
+    }
+    else if (cmd.name == "info")
+    {
+        if (cmd.pid <= MIN_PID)
+        {
+            read_info(client, cmd.ecu);
+        }
+        else
+        {
+            request(client, obd_service::vehicle_info, cmd.pid, cmd.ecu);
+        }
+    }
+    else if (cmd.name == "request" || cmd.name == "read")
+    {
+        request(client, cmd.service, cmd.pid, cmd.ecu);
+    }
+    else if (cmd.name == "sniff" || cmd.name == "monitor")
+    {
+        sniff(can, client.wait());
+    }
+    else if (cmd.name == "poll" || cmd.name == "stream")
     {
-        uint16_t dtc = static_cast<uint16_t>(defragmented[i]) << 8;
-        dtc |= defragmented[++i];
-        std::cout << decode_dtc(dtc) << std::endl;
+        poll(client, cmd);
     }
+    else if (cmd.name == "watch-faults" || cmd.name == "watch")
+    {
+        watch_faults(client, cmd.ecu);
+    }
+    else
+    {
+        known = false;
+    }
+
+    client.wait(wait);
+
+    return known;
 }
 
-void request(CANDevice &can, int service, int pid, int ecu = ANY_ECU)
+// service of a command that is a single request/response to one ECU, -1 otherwise
+int overlappable_service(const command &cmd)
 {
-    if (service < MIN_SERVICE || service > MAX_SERVICE)
+    if (cmd.ecu == ANY_ECU || cmd.wait.count() > 0)
     {
-        std::cerr << "Impossible Service ID" << std::endl;
-        return;
+        return -1;
     }
 
-    if (pid < MIN_PID || pid > MAX_PID)
+    int service = -1;
+    if (cmd.name == "show" || cmd.name == "data")
     {
-        std::cerr << "Impossible PID" << std::endl;
-        return;
+        service = obd_service::show_data;
     }
-
-    can_data buffer{};
-    std::fill(buffer.begin(), buffer.end(), OBD_PAD_BYTE);
-
-    // Generate ISO-15765 headers + OBD-II command
-    buffer[1] = (uint8_t)service;
-    if (pid > MAX_STANDARD_PID)
+    else if (cmd.name == "frozen" || cmd.name == "freeze")
     {
-        buffer[2] = (uint8_t)(pid >> 8);
-        buffer[3] = (uint8_t)pid;
-        buffer[0] = 3;
+        service = obd_service::freeze_frame;
     }
-    else
+    else if (cmd.name == "info" && cmd.pid > MIN_PID)
     {
-        buffer[2] = (uint8_t)pid;
-        buffer[0] = 2;
+        service = obd_service::vehicle_info;
     }
-
-
-    if (ecu < 0)
+    else if (cmd.name == "request" || cmd.name == "read")
     {
-        // Broadcast to all ECUs
-        can.filter(OBD_ECU_RECV_BASE, ~0x07);
-        can.data_send(OBD_BROADCAST, buffer);
+        service = cmd.service;
     }
-    else
+
+    return (service >= MIN_SERVICE && service <= MAX_SERVICE && cmd.pid >= MIN_PID && cmd.pid <= MAX_PID) ? service : -1;
+}
+
+// Requests to distinct ECUs in flight together, results printed in order as they complete
+void request_overlapped(OBDClient &client, const std::vector<command> &commands, const std::vector<std::string> &lines)
+{
+    std::vector<obd_query> queries;
+    for (const command &cmd : commands)
     {
-        can.filter(ecu + OBD_ECU_RECV_BASE);
-        can.data_send(ecu + OBD_ECU_SEND_BASE, buffer);
+        queries.push_back({cmd.ecu, overlappable_service(cmd), cmd.pid});
     }
 
-    const std::vector<uint8_t> defragmented = receive_multipart(can);
-    if (defragmented.empty() || (defragmented[0] & UNKNOWN_RESPONSE) != service)
+    std::vector<std::optional<obd_reply>> replies(queries.size());
+    std::vector<bool> done(queries.size());
+
+    size_t printed = 0;
+    client.request_overlapped(queries, [&](size_t index, const std::optional<obd_reply> &reply) {
+        replies[index] = reply;
+        done[index] = true;
+
+        while (printed < done.size() && done[printed])
+        {
+            std::cout << "> " << lines[printed] << std::endl;
+            print_results(replies[printed]);
+            printed++;
+        }
+    });
+}
+
+void batch(CANDevice &can, OBDClient &client, const std::string &path)
+{
+    std::ifstream file;
+    if (!path.empty() && path != "-")
     {
-        // unknown service
-        return;
+        file.open(path);
+        if (!file)
+        {
+            std::cerr << "Cannot open " << path << std::endl;
+            return;
+        }
     }
-    
-    int i = ISO15765_DATA_OFFSET;
-    if (service == 0x09)
+    std::istream &input = file.is_open() ? file : std::cin;
+
+    // consecutive single ECU requests to distinct ECUs run overlapped
+    std::vector<command> group;
+    std::vector<std::string> group_lines;
+    auto flush_group = [&]() {
+        if (group.size() == 1)
+        {
+            std::cout << "> " << group_lines.front() << std::endl;
+            run_command(can, client, group.front());
+        }
+        else if (!group.empty())
+        {
+            request_overlapped(client, group, group_lines);
+        }
+        group.clear();
+        group_lines.clear();
+        std::cout.flush();
+    };
+
+    std::string line;
+    while (std::getline(input, line))
     {
-        // Info request (service 0x09) appears to begins with 0x01, unclear why
-        i++;
+        std::istringstream words{line};
+        std::vector<std::string> args{std::istream_iterator<std::string>{words}, std::istream_iterator<std::string>{}};
+
+        if (args.empty() || args.front().front() == '#')
+        {
+            continue;
+        }
+
+        command cmd{};
+        try
+        {
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                if (command_option(cmd, args, i))
+                {
+                    continue;
+                }
+                else if ((cmd.name == "poll" || cmd.name == "stream") && cmd.argument.empty())
+                {
+                    // PID list
+                    cmd.argument = args[i];
+                }
+                else
+                {
+                    cmd.name = args[i];
+                    std::transform(cmd.name.begin(), cmd.name.end(), cmd.name.begin(), ::tolower);
+                }
+            }
+        }
+        catch (const std::invalid_argument &error)
+        {
+            // skip the line, the rest of the script still runs
+            flush_group();
+            std::cout << "> " << line << std::endl << error.what() << std::endl;
+            continue;
+        }
+        catch (const std::out_of_range &error)
+        {
+            flush_group();
+            std::cout << "> " << line << std::endl << "Value out of range: " << error.what() << std::endl;
+            continue;
+        }
+
+        if (cmd.ecu >= client.addressing().max_ecus())
+        {
+            cmd.ecu = ANY_ECU;
+        }
+
+        const bool overlappable = overlappable_service(cmd) >= 0 &&
+            std::none_of(group.cbegin(), group.cend(), [&](const command &each) { return each.ecu == cmd.ecu; });
+
+        if (!overlappable)
+        {
+            flush_group();
+        }
+
+        if (overlappable_service(cmd) >= 0)
+        {
+            group.push_back(cmd);
+            group_lines.push_back(line);
+            continue;
+        }
+
+        std::cout << "> " << line << std::endl;
+        if (cmd.name == "batch" || cmd.name == "script" || !run_command(can, client, cmd))
+        {
+            std::cout << "Unknown command" << std::endl;
+        }
+        std::cout.flush();
     }
 
-    printf("Results (Service: %02x, PID: %02x, length: %i)\n", service, pid, static_cast<int>( defragmented.size() - i ) );
+    flush_group();
+}
+
+void print_rx_stats(const CANRxStats &stats)
+{
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
 
-    //defragmented[0] = pid | 0x40;
-    //defragmented[1] = service;
+    std::cerr << "Receive: kernel drops " << stats.kernel_drops
+        << ", overruns " << stats.overruns
+        << ", socket buffer " << stats.receive_buffer << " bytes" << std::endl;
 
-    for (; i < static_cast<int>( defragmented.size() ); i++)
+    if (stats.queue_capacity == 0)
     {
-        printf("%02x", defragmented[i]);
+        // no RX thread
+        return;
     }
 
-    std::cout << std::endl;
+    const auto average = (stats.frames > 0) ? (stats.handoff_total / static_cast<int64_t>(stats.frames)) : std::chrono::nanoseconds{};
+
+    std::cerr << "RX thread: " << stats.frames << " frames"
+        << ", hand-off avg " << duration_cast<microseconds>(average).count() << "us"
+        << " max " << duration_cast<microseconds>(stats.handoff_max).count() << "us"
+        << ", queue high water " << stats.queue_high_water << "/" << stats.queue_capacity
+        << ", queue full " << stats.queue_full << std::endl;
+}
+
+void print_pacing(const BusPacer &pacing)
+{
+    std::cerr << "Bus load: " << pacing.load() << "%" << (pacing.observed() ? "" : " (own frames only)")
+        << ", throttled " << pacing.throttled() << " requests for "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(pacing.throttled_time()).count() << "ms" << std::endl;
 }
 
 void print_help(const std::string &arg0)
@@ -463,14 +990,41 @@ void print_help(const std::string &arg0)
     std::cout << "\t\tfrozen - show freeze frame data for ECU (service=0x02)" << std::endl;
     std::cout << "\t\tpending - read pending fault codes (DTCs) (service=0x07)" << std::endl;
     std::cout << "\t\tinfo - read info (service=0x09)" << std::endl;
+    std::cout << "\t\tbatch [file] - run the commands of a script (default stdin), one per line with -e/-s/-p/-t, over one socket" << std::endl;
+    std::cout << "\t\tsniff - passively decode the OBD-II traffic of another tester, never transmits" << std::endl;
     std::cout << "\t\tpermanent - read permanent fault codes (DTCs) (service=0x0a)" << std::endl;
+    std::cout << "\t\twatch-faults - poll stored, pending and permanent DTCs of every ECU (or -e) until Ctrl-C, print the codes that appear and clear;"
+        << " an ECU silent for " << FAULT_LOST_ROUNDS << " rounds is LOST and its codes clear" << std::endl;
+    std::cout << "\t\tpoll <pid[:deadband],...> - poll show data PIDs until Ctrl-C, print a value only when it changed beyond its deadband" << std::endl;
     std::cout << std::endl;
     std::cout << "\tOptions:" << std::endl;
     std::cout << "\t\t-i <interface> - use this network interface" << std::endl;
-    std::cout << "\t\t-e <ecu> - only request from this ECU, 0-8. Do not broadcast (0x7df)" << std::endl;
+    std::cout << "\t\t-e <ecu> - only request from this ECU, 0-7 or the source address with -x, hex number. Do not broadcast (0x7df)" << std::endl;
+    std::cout << "\t\t-T - receive on a dedicated thread" << std::endl;
+    std::cout << "\t\t-R <bytes> - socket receive buffer size" << std::endl;
+    std::cout << "\t\t-M <file> - write Prometheus metrics to this file on exit and on SIGUSR1 (default stderr on SIGUSR1)" << std::endl;
+#ifdef OBEY_TRACE
+    std::cout << "\t\t-D <file> - trace dump file, written on exit, on errors and on SIGUSR2, default=obey.trace" << std::endl;
+#endif
+    std::cout << "\t\t-g <trigger> - poll: write the samples around the moment e.g. \"0c>3000&0d<10|05>=110\" comes true to capture-*.csv" << std::endl;
+    std::cout << "\t\t-W <pre>,<post> - trigger window in seconds before and after, default=5,5" << std::endl;
+    std::cout << "\t\t-I <seconds> - watch-faults interval, default=10" << std::endl;
+    std::cout << "\t\t-L <percent> - pace requests to keep the estimated bus load under this, default=off" << std::endl;
+    std::cout << "\t\t-B <bit/s> - bus bitrate for the load estimate, default=500000" << std::endl;
+    std::cout << "\t\t-d - print receive statistics (kernel drops, queue depth) on exit" << std::endl;
+    std::cout << "\t\t-x - use 29-bit addressing (0x18db33f1/0x18daxxf1)" << std::endl;
     std::cout << "\t\t-s <service> - service number, applies only to request command, hex number" << std::endl;
     std::cout << "\t\t-p <pid> - pid number, applies only to request command, hex number" << std::endl;
     std::cout << "\t\t-t <seconds> - wait for timeout before stopping packet receive, default=1s" << std::endl;
+    std::cout << "\t\t-b <frames> - flow control block size, 0 = no limit (default)" << std::endl;
+    std::cout << "\t\t-m <stmin> - flow control separation time, 0x00-0x7f ms or 0xf1-0xf9 100-900us, default=0" << std::endl;
+    std::cout << "\t\t-w <frames> - flow control WAIT frames sent ahead of each clear to send, default=0, 100ms apart" << std::endl;
+    std::cout << "\t\t-o <file> - binary log of sniffed frames and poll samples, read with obey_log; poll then prints nothing" << std::endl;
+    std::cout << "\t\t\tand logs only changed values and -k heartbeats, like it would print them" << std::endl;
+    std::cout << "\t\t-S <name> - publish every polled value to this shared memory table (e.g. /obey), see SharedValues.hpp" << std::endl;
+    std::cout << "\t\t-r <hz> - poll rate, default=20" << std::endl;
+    std::cout << "\t\t-k <seconds> - poll heartbeat, print unchanged values this often, default=0 (never)" << std::endl;
+    std::cout << "\t\t-l <bytes> - refuse (OVERFLOW) multi-frame responses longer than this, default=4095" << std::endl;
 }
 
 int main(int argc, const char* argv[])
@@ -481,104 +1035,236 @@ int main(int argc, const char* argv[])
         return 1;
     }
 
-    std::string cmd = "help";
+    command cmd{};
 
     std::string interface = "can0";
-    int ecu = ANY_ECU;
-    int service = -1;
-    int pid = -1;
+    bool extended = false;
+    bool threaded = false;
+    bool diagnostics = false;
+    int receive_buffer = 0;
+    uint32_t bitrate = 500000;
+    double load_target = 0;
+
+    const std::vector<std::string> args(argv + 1, argv + argc);
 
     // Arguments
-    for (int i = 1; i < argc; i++)
+    try
     {
-        const std::string arg{argv[i]};
-        if (arg == "-i")
-        {
-            interface = argv[++i];
-        }
-        else if (arg == "-s")
-        {
-           service = std::stol(argv[++i], nullptr, 16);
-        }
-        else if (arg == "-p")
-        {
-            pid = std::stol(argv[++i], nullptr, 16);
-        }
-        else if (arg == "-e")
+        for (size_t i = 0; i < args.size(); i++)
         {
-            ecu = std::stol(argv[++i]);
-            if (ecu >= MAX_ECUS)
+            const std::string &arg = args[i];
+            if (command_option(cmd, args, i))
             {
-                std::cerr << "Warning: impossible ECU number, using broadcast" << std::endl;
-                ecu = ANY_ECU;
+                continue;
+            }
+            else if (arg == "-i")
+            {
+                interface = option_value(args, i);
+            }
+            else if (arg == "-x")
+            {
+                extended = true;
+            }
+            else if (arg == "-T")
+            {
+                threaded = true;
+            }
+            else if (arg == "-R")
+            {
+                receive_buffer = std::stol(option_value(args, i));
+            }
+            else if (arg == "-M")
+            {
+                metrics_file = option_value(args, i);
+                Metrics::export_path(metrics_file);
+            }
+            else if (arg == "-D")
+            {
+    #ifdef OBEY_TRACE
+                Trace::output_path(option_value(args, i));
+    #else
+                ++i;
+                std::cerr << "Warning: tracing not compiled in, build with -DOBEY_TRACE=ON" << std::endl;
+    #endif
+            }
+            else if (arg == "-d")
+            {
+                diagnostics = true;
+            }
+            else if (arg == "-b")
+            {
+                flow_control.block_size = static_cast<uint8_t>(std::stol(option_value(args, i), nullptr, 0));
+            }
+            else if (arg == "-m")
+            {
+                flow_control.st_min = static_cast<uint8_t>(std::stol(option_value(args, i), nullptr, 0));
+            }
+            else if (arg == "-w")
+            {
+                flow_control.wait_frames = std::stol(option_value(args, i));
+            }
+            else if (arg == "-l")
+            {
+                flow_control.max_length = std::min(static_cast<int>(std::stol(option_value(args, i))), MAX_LENGTH);
+            }
+            else if (arg == "-o")
+            {
+                log_file = option_value(args, i);
+            }
+            else if (arg == "-g")
+            {
+                trigger_expression = option_value(args, i);
+            }
+            else if (arg == "-W")
+            {
+                // pre,post seconds
+                const std::string window = option_value(args, i);
+                const size_t comma = window.find(',');
+                trigger_pre = std::chrono::milliseconds(static_cast<int64_t>(std::stod(window.substr(0, comma)) * 1000));
+                if (comma != std::string::npos)
+                {
+                    trigger_post = std::chrono::milliseconds(static_cast<int64_t>(std::stod(window.substr(comma + 1)) * 1000));
+                }
+            }
+            else if (arg == "-I")
+            {
+                fault_interval = std::chrono::seconds(std::max(std::stol(option_value(args, i)), 1L));
+            }
+            else if (arg == "-L")
+            {
+                load_target = std::stod(option_value(args, i));
+            }
+            else if (arg == "-B")
+            {
+                bitrate = std::stoul(option_value(args, i));
+            }
+            else if (arg == "-S")
+            {
+                shared_values = option_value(args, i);
+            }
+            else if (arg == "-r")
+            {
+                poll_rate = std::max(std::stod(option_value(args, i)), 0.01);
+            }
+            else if (arg == "-k")
+            {
+                poll_heartbeat = std::chrono::milliseconds(static_cast<int64_t>(std::stod(option_value(args, i)) * 1000));
+            }
+            else if ((cmd.name == "batch" || cmd.name == "poll" || cmd.name == "stream") && cmd.argument.empty())
+            {
+                // script file, PID list
+                cmd.argument = arg;
+            }
+            else
+            {
+                cmd.name = arg;
+                std::transform(cmd.name.begin(), cmd.name.end(), cmd.name.begin(), ::tolower);
             }
         }
-        else if (arg == "-t")
-        {
-            const int sec = std::stol(argv[++i]);
-            wait_override = std::chrono::seconds(sec);
-        }
-        else
+
+        if (cmd.name == "poll" || cmd.name == "stream")
         {
-            cmd = arg;
-            std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+            // a bad -g is reported with the other arguments, not once polling starts
+            check_trigger(cmd);
         }
     }
+    catch (const std::invalid_argument &error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    catch (const std::out_of_range &error)
+    {
+        std::cerr << "Value out of range: " << error.what() << std::endl;
+        return 1;
+    }
 
-    CANDevice can{interface};
-
-    if (cmd == "enum" || cmd == "list")
+    if (cmd.name == "help")
     {
-        // enumerate the ECUs
-        enumerate(can);
+        print_help(argv[0]);
+        return 0;
     }
-    else if (cmd == "show" || cmd == "data")
+
+    const OBDAddressing addressing{extended};
+    if (cmd.ecu >= addressing.max_ecus())
     {
-        request(can, SHOW_DATA_SERVICE, pid, ecu);
+        std::cerr << "Warning: impossible ECU number, using broadcast" << std::endl;
+        cmd.ecu = ANY_ECU;
     }
-    else if (cmd == "frozen" || cmd == "freeze")
+
+    Metrics::install_signal();
+
+#ifdef OBEY_TRACE
+    Trace::install_signal();
+    std::set_terminate([]() {
+        if (!Trace::dump())
+        {
+            std::perror("Trace dump");
+        }
+        std::abort();
+    });
+#endif
+
+    CANDevice can{interface};
+    if (receive_buffer > 0)
     {
-        request(can, SHOW_FREEZE_FRAME_SERVICE, pid, ecu);
+        can.receive_buffer(receive_buffer);
     }
-    else if (cmd == "clear")
+
+    if (threaded)
     {
-        // Clear DTCs
-        clear_dtc(can, ecu);
+        can.start_rx_thread();
     }
-    else if (cmd == "faults" || cmd == "dtc")
+
+    if (load_target > 0)
     {
-        read_dtc(can, ecu);
+        pacer = std::make_unique<BusPacer>(interface, bitrate, load_target);
+        if (!pacer->observed())
+        {
+            std::cerr << "Warning: no statistics of " << interface << ", bus load from our own frames only" << std::endl;
+        }
     }
-    else if (cmd == "pending")
+
+    OBDClient client{can, addressing};
+    client.flow_control(flow_control);
+    client.pacing(pacer.get());
+    client.idle([]() {
+        poll_metrics();
+#ifdef OBEY_TRACE
+        Trace::poll();
+#endif
+    });
+
+    if (cmd.name == "batch" || cmd.name == "script")
     {
-        read_dtc(can, ecu, fault_code_source::pending);
+        batch(can, client, cmd.argument);
     }
-    else if (cmd == "permanent" || cmd == "perm")
+    else if (!run_command(can, client, cmd))
     {
-        read_dtc(can, ecu, fault_code_source::permanent);
+        std::cerr << "Unknown command" << std::endl;
     }
-    else if (cmd == "info")
+
+    if (!metrics_file.empty())
     {
-        if (pid <= MIN_PID)
-        {
-            read_info(can, ecu);
-        }
-        else
-        {
-            request(can, VEHICLE_INFO_SERVICE, pid, ecu);
-        }
+        write_metrics();
     }
-    else if (cmd == "request" || cmd == "read")
+
+#ifdef OBEY_TRACE
+    if (!Trace::dump())
     {
-        request(can, service, pid, ecu);
+        std::perror("Trace dump");
     }
-    else if (cmd == "help")
+#endif
+
+    const CANRxStats stats = can.rx_stats();
+    if (diagnostics || stats.kernel_drops > 0)
     {
-        print_help(argv[0]);
+        print_rx_stats(stats);
     }
-    else
+
+    if (pacer && (diagnostics || pacer->throttled() > 0))
     {
-        std::cerr << "Unknown command" << std::endl;
+        print_pacing(*pacer);
     }
 
     return 0;
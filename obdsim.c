@@ -15,6 +15,26 @@
 
 static int quit = 0;
 
+#define OBD_BROADCAST_29 0x18db33f1
+#define ECU_ADDRESS_29 0x10
+
+static int is_broadcast(uint32_t id)
+{
+    return id == 0x7df || id == (OBD_BROADCAST_29 | CAN_EFF_FLAG);
+}
+
+// response id of the ecu-th responder (broadcast) or of the addressed ECU (physical)
+static uint32_t response_id(uint32_t id, int ecu)
+{
+    if (id & CAN_EFF_FLAG)
+    {
+        const uint32_t source = is_broadcast(id) ? (ECU_ADDRESS_29 + 8 * ecu) : ((id >> 8) & 0xff);
+        return 0x18daf100 | source | CAN_EFF_FLAG;
+    }
+
+    return is_broadcast(id) ? (0x7e8 + ecu) : (id + 8);
+}
+
 void handler(int s)
 {
     quit = 1;
@@ -54,9 +74,11 @@ int main(int argc, const char *argv[])
         return 1;
     }
 
-    struct can_filter filter[2] = {
-        {0x7e0, CAN_SFF_MASK & ~0x0f},
-        {0x7df, CAN_SFF_MASK}
+    struct can_filter filter[4] = {
+        {0x7e0, (CAN_SFF_MASK & ~0x0f) | CAN_EFF_FLAG},
+        {0x7df, CAN_SFF_MASK | CAN_EFF_FLAG},
+        {0x18da00f1 | CAN_EFF_FLAG, (CAN_EFF_MASK & ~0xff00) | CAN_EFF_FLAG},
+        {OBD_BROADCAST_29 | CAN_EFF_FLAG, CAN_EFF_MASK | CAN_EFF_FLAG}
     };
     setsockopt(sockfd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter[0], sizeof(filter));
 
@@ -87,7 +109,7 @@ int main(int argc, const char *argv[])
 
         if (data[1] == 0x01)
         {
-            if (id == 0x7df)
+            if (is_broadcast(id))
             {
                 // ecu 0
                 uint32_t bytes = 0xebeb81bb;
@@ -96,7 +118,7 @@ int main(int argc, const char *argv[])
                 data[0] = 0x07;
                 data[1] = 0x41;
                 memset(&frame, 0, sizeof(struct can_frame));
-                frame.can_id = 0x7e8;
+                frame.can_id = response_id(id, 0);
                 frame.len = 8;
                 memcpy(frame.data, data, sizeof(data));
 
@@ -115,7 +137,7 @@ int main(int argc, const char *argv[])
                 data[0] = 0x07;
                 data[1] = 0x41;
                 memset(&frame, 0, sizeof(struct can_frame));
-                frame.can_id = 0x7e9;
+                frame.can_id = response_id(id, 1);
                 frame.len = 8;
                 memcpy(frame.data, data, sizeof(data));
                 if (send(sockfd, &frame, sizeof(struct can_frame), 0) < 0)
@@ -147,7 +169,7 @@ int main(int argc, const char *argv[])
 
 
                 memset(&frame, 0, sizeof(struct can_frame));
-                frame.can_id = id + 8;
+                frame.can_id = response_id(id, 0);
                 frame.len = 8;
                 memcpy(frame.data, data, sizeof(data));
 
@@ -165,11 +187,7 @@ int main(int argc, const char *argv[])
         }
         else if (data[1] == 0x09)
         {
-            uint32_t id2 = 0x7e8;
-            if (id != 0x7df)
-            {
-                id2 = id + 8;
-            }
+            uint32_t id2 = response_id(id, 0);
 
             int vin = 0;
 
@@ -244,7 +262,7 @@ int main(int argc, const char *argv[])
             uint8_t service = data[1];
 
             memset(&frame, 0, sizeof(struct can_frame));
-            frame.can_id = 0x7e8;
+            frame.can_id = response_id(id, 0);
             frame.len = 8;
             memset(data, 0x00, sizeof(data));
             data[0] = 0x10;
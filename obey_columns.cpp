@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <system_error>
+
+#include "BinaryLog.hpp"
+#include "Columnar.hpp"
+
+// Aligns the samples of a binary log written by obey poll -o onto a fixed rate grid,
+// written as memory mappable columns, see Columnar.hpp
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("USAGE: %s <log file> <output> [rate Hz, default=10] [last|linear, default=last]\n", argv[0]);
+        return 1;
+    }
+
+    const double rate = (argc > 3) ? std::stod(argv[3]) : 10.0;
+    const std::string interpolation = (argc > 4) ? argv[4] : "last";
+    if (rate <= 0 || (interpolation != "last" && interpolation != "linear"))
+    {
+        fprintf(stderr, "Rate must be positive, interpolation last or linear\n");
+        return 1;
+    }
+    const resample_mode mode = (interpolation == "linear") ? resample_mode::linear : resample_mode::last_value;
+
+    try
+    {
+        const auto started = std::chrono::steady_clock::now();
+
+        LogReader log{argv[1]};
+        ColumnarExport columns{log.header(), log.channels()};
+
+        uint64_t samples = 0;
+        log_record record{};
+        while (log.next(record))
+        {
+            if (record.type == log_record_type::sample_record)
+            {
+                columns.sample(record.channel, record.time, record.value);
+                samples++;
+            }
+        }
+        columns.define(log.channels());
+
+        const auto read = std::chrono::steady_clock::now();
+        const size_t rows = columns.write(argv[2], rate, mode);
+
+        const std::chrono::duration<double> reading = read - started;
+        const std::chrono::duration<double> writing = std::chrono::steady_clock::now() - read;
+        fprintf(stderr, "%llu samples of %zu channels to %zu rows, read %.3fs, aligned %.3fs\n",
+            static_cast<unsigned long long>(samples), log.channels().size(), rows, reading.count(), writing.count());
+    }
+    catch (const std::system_error &error)
+    {
+        fprintf(stderr, "%s\n", error.what());
+        return 2;
+    }
+
+    return 0;
+}
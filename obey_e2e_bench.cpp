@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "CAN.hpp"
+#include "OBD.hpp"
+#include "OBDClient.hpp"
+#include "OBDDescriptor.hpp"
+#include "PID.hpp"
+
+// Round trips through the real request path (CANDevice, ISO 15765 reassembly, OBDClient)
+// against a simulated ECU that answers without delay. The ECU runs on a thread at the other
+// end of a socketpair, or on a second raw socket of a vcan interface with -i.
+
+using namespace std::chrono_literals;
+
+static const int BROADCAST_ECUS = 4;
+static const char VIN[] = "1OBEYBENCH0000042";
+
+// Answers show data PIDs as single frames, the VIN as a multi-frame response (after the
+// flow control) and broadcasts from BROADCAST_ECUS ECUs
+class SimulatedECU
+{
+    public:
+        SimulatedECU(CANDevice &can, const OBDAddressing &addressing)
+        : can{ can }, obd{ addressing }, thread{ &SimulatedECU::run, this }
+        {
+        }
+
+        ~SimulatedECU()
+        {
+            running = false;
+            thread.join();
+        }
+
+        // ECU numbers of the responders, source addresses with 29-bit
+        static int ecu(const OBDAddressing &addressing, int index)
+        {
+            return addressing.extended() ? 0x10 + 8 * index : index;
+        }
+
+    private:
+        void run()
+        {
+            while (running.load(std::memory_order_relaxed))
+            {
+                uint32_t id = 0;
+                obd_frame request{};
+                if (can.data_receive(id, request))
+                {
+                    answer(id, request);
+                }
+            }
+        }
+
+        void answer(uint32_t id, const obd_frame &request)
+        {
+            if ((request[0] & 0xf0) == 0x30)
+            {
+                // flow control of the pending multi-frame response
+                for (const obd_frame &frame : consecutive)
+                {
+                    can.data_send(consecutive_id, frame);
+                }
+                consecutive.clear();
+                return;
+            }
+
+            const int service = request[1];
+            const int pid = request[2];
+
+            if (obd.is_broadcast(id))
+            {
+                for (int i = 0; i < BROADCAST_ECUS; i++)
+                {
+                    can.data_send(obd.response_id(ecu(obd, i)), {0x06, static_cast<uint8_t>(service | OBD_RESPONSE_OFFSET),
+                        static_cast<uint8_t>(pid), 0xbe, 0x1f, 0xa8, 0x13, OBD_PAD_BYTE});
+                }
+                return;
+            }
+
+            const int target = obd.ecu_of_request(id);
+            if (target == ANY_ECU)
+            {
+                return;
+            }
+
+            if (service == obd_service::vehicle_info && pid == 0x02)
+            {
+                // 49 02 01 + 17 characters
+                std::vector<uint8_t> data{0x49, 0x02, 0x01};
+                data.insert(data.end(), VIN, VIN + sizeof(VIN) - 1);
+
+                obd_frame first{static_cast<uint8_t>(0x10 | (data.size() >> 8)), static_cast<uint8_t>(data.size())};
+                std::copy(data.begin(), data.begin() + 6, first.begin() + 2);
+
+                consecutive_id = obd.response_id(target);
+                consecutive.clear();
+                for (size_t offset = 6, sequence = 1; offset < data.size(); offset += 7, sequence++)
+                {
+                    obd_frame frame{};
+                    frame.fill(OBD_PAD_BYTE);
+                    frame[0] = 0x20 | (sequence & 0x0f);
+                    std::copy(data.begin() + offset, data.begin() + std::min(offset + 7, data.size()), frame.begin() + 1);
+                    consecutive.push_back(frame);
+                }
+
+                can.data_send(consecutive_id, first);
+                return;
+            }
+
+            // engine speed 0x0fa0 (1000 rpm) for any PID
+            can.data_send(obd.response_id(target), {0x04, static_cast<uint8_t>(service | OBD_RESPONSE_OFFSET),
+                static_cast<uint8_t>(pid), 0x0f, 0xa0, OBD_PAD_BYTE, OBD_PAD_BYTE, OBD_PAD_BYTE});
+        }
+
+        CANDevice &can;
+        const OBDAddressing obd;
+
+        uint32_t consecutive_id{};
+        std::vector<obd_frame> consecutive;
+
+        std::atomic<bool> running{true};
+        std::thread thread;
+};
+
+struct scenario_result
+{
+    std::string name;
+    size_t requests;
+    size_t failures;
+    double seconds;
+    std::vector<int64_t> latencies; // ns, sorted
+};
+
+// nearest rank
+static double percentile_us(const std::vector<int64_t> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    const size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1] / 1000.0;
+}
+
+static scenario_result run_scenario(const std::string &name, size_t requests, const std::function<bool()> &round_trip)
+{
+    // warm up caches, the allocator and the simulated ECU
+    for (size_t i = 0; i < std::min<size_t>(requests / 10, 1000); i++)
+    {
+        round_trip();
+    }
+
+    scenario_result result{name, requests, 0, 0, {}};
+    result.latencies.reserve(requests);
+
+    const auto started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < requests; i++)
+    {
+        const auto sent = std::chrono::steady_clock::now();
+        if (!round_trip())
+        {
+            result.failures++;
+            continue;
+        }
+        result.latencies.push_back((std::chrono::steady_clock::now() - sent).count());
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    std::sort(result.latencies.begin(), result.latencies.end());
+
+    return result;
+}
+
+// Completed round trips only, a failure spends its time waiting for the timeout
+static double throughput(const scenario_result &result)
+{
+    return (result.seconds > 0) ? ((result.requests - result.failures) / result.seconds) : 0;
+}
+
+static void print_result(const scenario_result &result)
+{
+    printf("%-10s %8zu %6zu %12.0f %10.1f %10.1f %10.1f %10.1f%s\n", result.name.c_str(), result.requests, result.failures,
+        throughput(result), percentile_us(result.latencies, 0.5), percentile_us(result.latencies, 0.99),
+        percentile_us(result.latencies, 0.999), result.latencies.empty() ? 0.0 : result.latencies.back() / 1000.0,
+        (result.failures > 0) ? "  ! failures" : "");
+}
+
+// One row per scenario appended to a CSV file, the header written when the file is new
+static void append_csv(const std::string &path, const std::string &transport, const std::vector<scenario_result> &results)
+{
+    struct stat info{};
+    const bool exists = ::stat(path.c_str(), &info) == 0 && info.st_size > 0;
+
+    FILE *file = std::fopen(path.c_str(), "a");
+    if (file == nullptr)
+    {
+        throw std::system_error(errno, std::system_category(), "Results " + path);
+    }
+
+    if (!exists)
+    {
+        std::fprintf(file, "time,transport,scenario,requests,failures,seconds,requests_per_second,p50_us,p99_us,p999_us,max_us\n");
+    }
+
+    const long long now = std::time(nullptr);
+    for (const scenario_result &result : results)
+    {
+        std::fprintf(file, "%lld,%s,%s,%zu,%zu,%.6f,%.1f,%.2f,%.2f,%.2f,%.2f\n", now, transport.c_str(), result.name.c_str(),
+            result.requests, result.failures, result.seconds, throughput(result),
+            percentile_us(result.latencies, 0.5), percentile_us(result.latencies, 0.99), percentile_us(result.latencies, 0.999),
+            result.latencies.empty() ? 0.0 : result.latencies.back() / 1000.0);
+    }
+
+    std::fclose(file);
+}
+
+int main(int argc, const char *argv[])
+{
+    size_t requests = 20000;
+    bool extended = false;
+    bool threaded = false;
+    std::string interface;
+    std::string output;
+
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (args[i] == "-n" && i + 1 < args.size())
+        {
+            requests = std::max(std::stoul(args[++i]), 1UL);
+        }
+        else if (args[i] == "-i" && i + 1 < args.size())
+        {
+            interface = args[++i];
+        }
+        else if (args[i] == "-o" && i + 1 < args.size())
+        {
+            output = args[++i];
+        }
+        else if (args[i] == "-x")
+        {
+            extended = true;
+        }
+        else if (args[i] == "-T")
+        {
+            threaded = true;
+        }
+        else
+        {
+            printf("USAGE: %s [-n requests] [-i vcan0] [-x] [-T] [-o results.csv]\n", argv[0]);
+            printf("\t-n <requests> - round trips per scenario, default=20000\n");
+            printf("\t-i <interface> - simulated ECU on a second socket of this (v)can interface, default=socketpair\n");
+            printf("\t-x - 29-bit addressing\n");
+            printf("\t-T - receive on a dedicated thread\n");
+            printf("\t-o <file> - append the results to this CSV file\n");
+            return 1;
+        }
+    }
+
+    try
+    {
+        const OBDAddressing addressing{extended};
+
+        std::unique_ptr<CANDevice> tester;
+        std::unique_ptr<CANDevice> bus;
+        if (interface.empty())
+        {
+            int sockets[2];
+            if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) < 0)
+            {
+                throw std::system_error(errno, std::system_category(), "Socketpair");
+            }
+            tester = std::make_unique<CANDevice>(sockets[0]);
+            bus = std::make_unique<CANDevice>(sockets[1]);
+        }
+        else
+        {
+            tester = std::make_unique<CANDevice>(interface);
+            bus = std::make_unique<CANDevice>(interface);
+
+            // requests and flow control only
+            const uint32_t flag = extended ? CAN_EFF_FLAG : 0;
+            const uint32_t mask = extended ? CAN_EFF_MASK : CAN_SFF_MASK;
+            std::vector<can_filter> filters{{addressing.broadcast_id() | flag, mask | CAN_EFF_FLAG}};
+            for (int i = 0; i < BROADCAST_ECUS; i++)
+            {
+                filters.push_back({addressing.request_id(SimulatedECU::ecu(addressing, i)) | flag, mask | CAN_EFF_FLAG});
+            }
+            bus->filter(filters);
+        }
+
+        if (threaded)
+        {
+            tester->start_rx_thread();
+        }
+
+        SimulatedECU ecu{*bus, addressing};
+
+        OBDClient client{*tester, addressing};
+        client.wait(100ms);
+
+        const int target = SimulatedECU::ecu(addressing, 0);
+        const pid_info &rpm = *find_pid(0x0c);
+
+        std::vector<scenario_result> results;
+        results.push_back(run_scenario("single", requests, [&]() {
+            return client.read_pid(rpm, target).has_value();
+        }));
+        results.push_back(run_scenario("multi", requests, [&]() {
+            return client.vin(target).has_value();
+        }));
+        results.push_back(run_scenario("broadcast", requests, [&]() {
+            return client.broadcast(make_request_frame(obd_service::show_data, 0x00), obd_service::show_data,
+                BROADCAST_ECUS).size() == BROADCAST_ECUS;
+        }));
+
+        const std::string transport = (interface.empty() ? std::string{"socketpair"} : interface) +
+            (extended ? "/29" : "/11") + (threaded ? "/rx-thread" : "");
+
+        printf("# %s, %zu round trips per scenario\n", transport.c_str(), requests);
+        printf("%-10s %8s %6s %12s %10s %10s %10s %10s\n", "scenario", "requests", "failed", "requests/s", "p50 us", "p99 us",
+            "p99.9 us", "max us");
+        for (const scenario_result &result : results)
+        {
+            print_result(result);
+        }
+
+        if (!output.empty())
+        {
+            append_csv(output, transport, results);
+        }
+    }
+    catch (const std::exception &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 2;
+    }
+
+    return 0;
+}
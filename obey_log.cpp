@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <system_error>
+
+#include "BinaryLog.hpp"
+
+// Converts binary logs written by obey -o to CSV, optionally a time range in seconds
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("USAGE: %s <log file> [from seconds] [to seconds]\n", argv[0]);
+        return 1;
+    }
+
+    const uint64_t from = (argc > 2) ? static_cast<uint64_t>(std::stod(argv[2]) * 1e6) : 0;
+    const uint64_t to = (argc > 3) ? static_cast<uint64_t>(std::stod(argv[3]) * 1e6) : UINT64_MAX;
+
+    try
+    {
+        LogReader log{argv[1]};
+        const log_header &header = log.header();
+
+        printf("# start %lld.%06lld\n", static_cast<long long>(header.start / 1000000),
+            static_cast<long long>(header.start % 1000000));
+        printf("# VIN %s\n", header.vin.empty() ? "-" : header.vin.c_str());
+        for (const auto &[ecu, pages] : header.capabilities)
+        {
+            printf("# ECU %d supported", ecu);
+            for (const uint32_t page : pages)
+            {
+                printf(" %08x", page);
+            }
+            printf("\n");
+        }
+        printf("time,ecu,service,pid,value\n");
+
+        const auto started = std::chrono::steady_clock::now();
+        uint64_t records = 0;
+
+        log.seek(from);
+
+        log_record record{};
+        while (log.next(record) && record.time <= to)
+        {
+            records++;
+
+            const double seconds = record.time / 1e6;
+            if (record.type == log_record_type::sample_record)
+            {
+                const log_channel channel = (record.channel < log.channels().size()) ?
+                    log.channels()[record.channel] : log_channel{-1, -1, -1};
+                printf("%.6f,%d,%02x,%02x,%.17g\n", seconds, channel.ecu, channel.service, channel.pid, record.value);
+            }
+            else
+            {
+                // raw frames: CAN id in place of the ECU, data bytes as the value
+                printf("%.6f,frame,%x,,", seconds, record.id);
+                for (int i = 0; i < record.length; i++)
+                {
+                    printf("%02x", record.data[i]);
+                }
+                printf("\n");
+            }
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        fprintf(stderr, "%llu records, %zu blocks in %.3fs\n", static_cast<unsigned long long>(records),
+            log.blocks().size(), elapsed.count());
+    }
+    catch (const std::system_error &error)
+    {
+        fprintf(stderr, "%s\n", error.what());
+        return 2;
+    }
+
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "Trace.hpp"
+
+// Offline decoder of trace dumps written by obey built with -DOBEY_TRACE=ON
+
+struct thread_record
+{
+    uint32_t thread;
+    trace_record event;
+};
+
+static const char *isotp_name(uint8_t detail)
+{
+    static const char *names[] = {"single", "first", "consecutive", "missed", "complete", "refused", "invalid"};
+    return (detail < sizeof(names) / sizeof(names[0])) ? names[detail] : "?";
+}
+
+static const char *flow_name(uint8_t detail)
+{
+    static const char *names[] = {"CTS", "WAIT", "OVERFLOW"};
+    return (detail < sizeof(names) / sizeof(names[0])) ? names[detail] : "?";
+}
+
+static void print_bytes(uint64_t data, int length)
+{
+    for (int i = 0; i < std::min(length, 8); i++)
+    {
+        printf("%02x", static_cast<unsigned>((data >> (8 * i)) & 0xff));
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("USAGE: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == nullptr)
+    {
+        perror("Open");
+        return 1;
+    }
+
+    char magic[sizeof(TRACE_MAGIC)];
+    double ticks_per_second = 0;
+    uint32_t threads = 0;
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&ticks_per_second, sizeof(ticks_per_second), 1, file) != 1 ||
+        fread(&threads, sizeof(threads), 1, file) != 1)
+    {
+        fprintf(stderr, "Not an obey trace\n");
+        return 2;
+    }
+
+    std::vector<thread_record> records;
+    for (uint32_t thread = 0; thread < threads; thread++)
+    {
+        uint64_t count = 0;
+        if (fread(&count, sizeof(count), 1, file) != 1)
+        {
+            fprintf(stderr, "Truncated trace\n");
+            return 2;
+        }
+
+        for (uint64_t i = 0; i < count; i++)
+        {
+            thread_record record{thread, {}};
+            if (fread(&record.event, sizeof(trace_record), 1, file) != 1)
+            {
+                fprintf(stderr, "Truncated trace\n");
+                return 2;
+            }
+            records.push_back(record);
+        }
+    }
+
+    fclose(file);
+
+    // merge the threads in time order
+    std::stable_sort(records.begin(), records.end(), [](const thread_record &a, const thread_record &b) {
+        return a.event.ticks < b.event.ticks;
+    });
+
+    const uint64_t origin = records.empty() ? 0 : records.front().event.ticks;
+
+    for (const thread_record &record : records)
+    {
+        const trace_record &event = record.event;
+        const double us = (event.ticks - origin) * 1e6 / ticks_per_second;
+
+        printf("%14.3f T%u ", us, record.thread);
+
+        switch (event.type)
+        {
+        case trace_type::can_tx:
+        case trace_type::can_rx:
+            printf("%s %08x#", (event.type == trace_type::can_tx) ? "TX" : "RX", event.id);
+            print_bytes(event.data, event.detail);
+            break;
+        case trace_type::isotp_state:
+            printf("ISOTP %08x %s value=%u offset=%llu", event.id, isotp_name(event.detail), event.value,
+                static_cast<unsigned long long>(event.data));
+            break;
+        case trace_type::flow_control_sent:
+            printf("FC %08x %s bs=%u stmin=0x%02llx", event.id, flow_name(event.detail), event.value,
+                static_cast<unsigned long long>(event.data));
+            break;
+        case trace_type::deadline_expired:
+            printf("DEADLINE wait=%ums", event.value);
+            break;
+        default:
+            printf("? type=%u", event.type);
+            break;
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}